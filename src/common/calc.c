@@ -0,0 +1,278 @@
+#include "calc.h"
+
+#include <unistd.h>
+#include <glib-2.0/glib.h>
+
+#include "utils.h"
+#include "dirlist.h"
+
+static char* key_delay_path(void) {
+    return g_build_filename(g_get_user_cache_dir(), "ticables-gdb-bridge", "key-delay", NULL);
+}
+
+// One line per link: "MODEL CABLE PORT DELAY FLOOR"
+static char* key_delay_link(CalcSession* session) {
+    return g_strdup_printf(
+        "%s %s %d",
+        ticalcs_model_to_string(session->model),
+        ticables_model_to_string(session->cable->model),
+        session->cable->port
+    );
+}
+
+char* calc_session_link_id(CalcSession* session) {
+    char *id = g_strdup_printf(
+        "%s-%s-%d",
+        ticalcs_model_to_string(session->model),
+        ticables_model_to_string(session->cable->model),
+        session->cable->port
+    );
+    return g_strcanon(id, G_CSET_A_2_Z G_CSET_a_2_z G_CSET_DIGITS "-+", '_');
+}
+
+static void load_key_delay(CalcSession* session) {
+    session->key_delay = KEY_DELAY_DEFAULT;
+    session->key_delay_floor = 0;
+    session->key_streak = 0;
+    session->key_delay_changed = false;
+    session->last_key_at = 0;
+
+    char *path = key_delay_path();
+    gchar *contents = NULL;
+    if(!g_file_get_contents(path, &contents, NULL, NULL)) {
+        g_free(path);
+        return;
+    }
+
+    char *link = key_delay_link(session);
+    size_t link_len = strlen(link);
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    for(int i = 0; lines[i] != NULL; i++) {
+        unsigned int delay, floor;
+        if(
+            strncmp(lines[i], link, link_len) == 0
+            && lines[i][link_len] == ' '
+            && sscanf(&lines[i][link_len], "%u %u", &delay, &floor) == 2
+        ) {
+            session->key_delay = delay > KEY_DELAY_MAX ? KEY_DELAY_MAX : delay;
+            session->key_delay_floor = floor > session->key_delay ? session->key_delay : floor;
+            log(LEVEL_DEBUG, "Learned key delay: %ums\n", session->key_delay);
+            break;
+        }
+    }
+
+    g_strfreev(lines);
+    g_free(link);
+    g_free(contents);
+    g_free(path);
+}
+
+static void save_key_delay(CalcSession* session) {
+    // Sessions on other cables share the file
+    static GMutex lock;
+
+    if(!session->key_delay_changed || session->cable == NULL) {
+        return;
+    }
+
+    g_mutex_lock(&lock);
+
+    char *path = key_delay_path();
+    char *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0755);
+
+    char *link = key_delay_link(session);
+    size_t link_len = strlen(link);
+    GString *out = g_string_new(NULL);
+
+    // Keep the other links' lines
+    gchar *contents = NULL;
+    if(g_file_get_contents(path, &contents, NULL, NULL)) {
+        gchar **lines = g_strsplit(contents, "\n", -1);
+        for(int i = 0; lines[i] != NULL; i++) {
+            if(lines[i][0] == '\0' || (strncmp(lines[i], link, link_len) == 0 && lines[i][link_len] == ' ')) {
+                continue;
+            }
+            g_string_append_printf(out, "%s\n", lines[i]);
+        }
+        g_strfreev(lines);
+        g_free(contents);
+    }
+
+    g_string_append_printf(out, "%s %u %u\n", link, session->key_delay, session->key_delay_floor);
+    if(!g_file_set_contents(path, out->str, out->len, NULL)) {
+        log(LEVEL_DEBUG, "Could not save the key delay to %s\n", path);
+    }
+
+    g_mutex_unlock(&lock);
+
+    g_string_free(out, TRUE);
+    g_free(link);
+    g_free(dir);
+    g_free(path);
+}
+
+int calc_session_open(CalcSession* session, CalcModel model, CableHandle* cable) {
+    session->model = model;
+    session->cable = cable;
+    session->keys_func = NULL;
+    session->dirlist = NULL;
+
+    switch(model) {
+        case CALC_TI83P:
+        case CALC_TI84P:
+        case CALC_TI84P_USB:
+        case CALC_TI84PC:
+        case CALC_TI84PC_USB:
+            session->keys_func = &ticalcs_keys_83p;
+            break;
+        default:
+            break;
+    }
+
+    load_key_delay(session);
+
+    session->calc = ticalcs_handle_new(model);
+    if(session->calc == NULL) {
+        return -1;
+    }
+
+    return ticalcs_cable_attach(session->calc, cable);
+}
+
+int calc_session_reattach(CalcSession* session, CableHandle* cable) {
+    ticalcs_cable_detach(session->calc);
+    session->cable = cable;
+    return ticalcs_cable_attach(session->calc, cable);
+}
+
+void calc_session_close(CalcSession* session) {
+    save_key_delay(session);
+    session->key_delay_changed = false;
+    dirlist_invalidate(session);
+    if(session->calc) {
+        ticalcs_cable_detach(session->calc);
+        ticalcs_handle_del(session->calc);
+        session->calc = NULL;
+    }
+}
+
+static void wait_for_key(CalcSession* session) {
+    // Only wait for what's left since the last ACK came back
+    uint64_t elapsed = utils_now_ms() - session->last_key_at;
+    if(elapsed < session->key_delay) {
+        usleep((session->key_delay - elapsed) * 1000);
+    }
+}
+
+static void key_failed(CalcSession* session) {
+    uint32_t failed = session->key_delay;
+    session->key_delay_floor = failed + KEY_DELAY_STEP;
+    session->key_delay = failed * 2 > session->key_delay_floor ? failed * 2 : session->key_delay_floor;
+    if(session->key_delay > KEY_DELAY_MAX) {
+        session->key_delay = KEY_DELAY_MAX;
+    }
+    if(session->key_delay_floor > session->key_delay) {
+        session->key_delay_floor = session->key_delay;
+    }
+    session->key_delay_changed = true;
+    session->key_streak = 0;
+
+    log(LEVEL_DEBUG, "Key failed at %ums, now waiting %ums\n", failed, session->key_delay);
+}
+
+static void key_succeeded(CalcSession* session) {
+    if(session->key_delay >= session->key_delay_floor + KEY_DELAY_STEP) {
+        session->key_delay -= KEY_DELAY_STEP;
+        session->key_delay_changed = true;
+    }
+    else if(session->key_delay_floor > 0 && ++session->key_streak >= KEY_FLOOR_DECAY) {
+        // The failure that raised the floor may have been bad luck
+        session->key_streak = 0;
+        session->key_delay_floor = session->key_delay_floor > KEY_DELAY_STEP ? session->key_delay_floor - KEY_DELAY_STEP : 0;
+        session->key_delay_changed = true;
+    }
+}
+
+int calc_send_key(CalcSession* session, uint32_t key, int retry) {
+    int err = 0;
+    int attempts = retry ? KEY_RETRIES : 1;
+
+    // Only learn from failures that a slower retry got past
+    uint32_t delay = session->key_delay;
+    uint32_t floor = session->key_delay_floor;
+    uint32_t streak = session->key_streak;
+    bool changed = session->key_delay_changed;
+
+    for(int i = 0; i < attempts; i++) {
+        wait_for_key(session);
+        err = ticalcs_calc_send_key(session->calc, key);
+        session->last_key_at = utils_now_ms();
+
+        if(!err) {
+            if(retry) {
+                key_succeeded(session);
+            }
+            return 0;
+        }
+
+        if(retry) {
+            log(LEVEL_DEBUG, "Could not send key %04x: %d\n", key, err);
+            key_failed(session);
+        }
+    }
+
+    if(retry) {
+        // Something other than pacing, like a pulled cable or a busy calculator
+        log(LEVEL_ERROR, "Gave up sending key %04x: %d\n", key, err);
+        session->key_delay = delay;
+        session->key_delay_floor = floor;
+        session->key_streak = streak;
+        session->key_delay_changed = changed;
+    }
+
+    return err;
+}
+
+int calc_send_key_raw(CalcSession* session, uint32_t key) {
+    switch(session->model) {
+        case CALC_TI83P:
+        case CALC_TI84P:
+        case CALC_TI84PC:
+            break;
+        default:
+            log(LEVEL_WARN, "Can't send raw keys to this model\n");
+            return -1;
+    }
+
+    // DBUS KEY packet from the PC, with the key code where the length goes
+    uint8_t packet[4] = { 0x23, 0x87, key & 0xff, (key >> 8) & 0xff };
+
+    wait_for_key(session);
+    int err = ticables_cable_send(session->cable, packet, sizeof(packet));
+    session->last_key_at = utils_now_ms();
+    if(err) {
+        log(LEVEL_ERROR, "Could not send key %04x: %d\n", key, err);
+    }
+
+    return err;
+}
+
+uint32_t calc_ascii_key(CalcSession* session, uint8_t ascii_code) {
+    if(session->keys_func == NULL) {
+        log(LEVEL_ERROR, "No key mapping for this model\n");
+        return 0;
+    }
+
+    const CalcKey *key = session->keys_func(ascii_code);
+    return key ? key->normal.value : 0;
+}
+
+void calc_send_ascii(CalcSession* session, const char* keys) {
+    for(int i = 0; i < strlen(keys); i++) {
+        uint32_t key = calc_ascii_key(session, keys[i]);
+        if(key) {
+            calc_send_key(session, key, 1);
+        }
+    }
+}
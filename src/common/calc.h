@@ -0,0 +1,87 @@
+#ifndef __COMMON_CALC_H__
+#define __COMMON_CALC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <tilp2/ticables.h>
+#include <tilp2/ticalcs.h>
+
+#define CABLE_TIMEOUT 20
+#define CABLE_FAST_TIMEOUT 2
+
+// Key pacing, in milliseconds
+#define KEY_DELAY_DEFAULT 100
+#define KEY_DELAY_MAX 500
+#define KEY_DELAY_STEP 5
+#define KEY_RETRIES 5
+// Keys in a row at the floor before it is lowered a step
+#define KEY_FLOOR_DECAY 50
+
+typedef struct Dirlist Dirlist;
+
+typedef struct {
+    CalcModel model;
+    CableHandle *cable;
+    CalcHandle *calc;
+    const CalcKey* (*keys_func)(uint8_t ascii_code);
+
+    // See dirlist.h
+    Dirlist *dirlist;
+    const char *dirlist_cache;
+
+    // Time to leave between a key's ACK and the next key
+    uint32_t key_delay;
+    // Don't go below this, it has failed before. It comes down a step
+    // after KEY_FLOOR_DECAY keys in a row go through at it.
+    uint32_t key_delay_floor;
+    uint32_t key_streak;
+    bool key_delay_changed;
+    uint64_t last_key_at;
+} CalcSession;
+
+/**
+ * Attach a calc handle to a cable from utils_setup_cable. This opens the
+ * cable, so don't open it yourself.
+ */
+int calc_session_open(CalcSession* session, CalcModel model, CableHandle* cable);
+
+/**
+ * Move the session over to a new cable handle, such as after a reset.
+ */
+int calc_session_reattach(CalcSession* session, CableHandle* cable);
+
+/**
+ * Short name for the calculator model and cable, safe for file names.
+ */
+char* calc_session_link_id(CalcSession* session);
+
+/**
+ * Saves the learned key delay, and frees the calc handle.
+ */
+void calc_session_close(CalcSession* session);
+
+/**
+ * Send a key once the calculator has had time to act on the last one.
+ *
+ * The delay is learned per model and cable: it shrinks while keys go
+ * through, and grows when one fails but a retry gets through. A key that
+ * fails every retry is blamed on something other than pacing and teaches
+ * nothing. Keys sent with retry are resent up to KEY_RETRIES times. Without retry, a failure is expected (such as when the
+ * key starts a program and the second ACK never comes) and is left alone.
+ */
+int calc_send_key(CalcSession* session, uint32_t key, int retry);
+
+/**
+ * Send a key without waiting for the calculator's ACK, which is left on the
+ * link along with whatever the key starts. Only for DBUS models.
+ */
+int calc_send_key_raw(CalcSession* session, uint32_t key);
+
+/**
+ * Key code for an alphanumeric character, or 0 if the model has no mapping.
+ */
+uint32_t calc_ascii_key(CalcSession* session, uint8_t ascii_code);
+
+void calc_send_ascii(CalcSession* session, const char* keys);
+
+#endif
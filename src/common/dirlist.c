@@ -0,0 +1,297 @@
+#include "dirlist.h"
+
+#include <stdio.h>
+
+#include "utils.h"
+
+#define DIRLIST_CACHE_MAGIC "TIDIRLIST"
+#define DIRLIST_CACHE_VERSION 1
+
+static char* entry_key(const char* name, uint8_t type) {
+    return g_strdup_printf("%02x:%s", type, name);
+}
+
+static int compare_entries(gconstpointer a, gconstpointer b) {
+    return strcmp((*(VarEntry* const*)a)->name, (*(VarEntry* const*)b)->name);
+}
+
+static void free_entry(gpointer data) {
+    tifiles_ve_delete(data);
+}
+
+static void free_names(gpointer data) {
+    g_slist_free(data);
+}
+
+static Dirlist* dirlist_new(CalcModel model) {
+    Dirlist *dirlist = g_new0(Dirlist, 1);
+    dirlist->model = model;
+
+    for(int i = 0; i < DIRLIST_COUNT; i++) {
+        DirlistIndex *list = &dirlist->lists[i];
+        list->entries = g_ptr_array_new_with_free_func(free_entry);
+        list->by_key = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        list->by_name = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_names);
+    }
+
+    return dirlist;
+}
+
+void dirlist_free(Dirlist* dirlist) {
+    if(dirlist == NULL) {
+        return;
+    }
+
+    for(int i = 0; i < DIRLIST_COUNT; i++) {
+        DirlistIndex *list = &dirlist->lists[i];
+        // The indexes point into the entries, so they go first
+        g_hash_table_destroy(list->by_key);
+        g_hash_table_destroy(list->by_name);
+        g_ptr_array_free(list->entries, TRUE);
+    }
+
+    g_free(dirlist);
+}
+
+static void add_entry(Dirlist* dirlist, DIRLIST_KIND kind, const VarEntry* src) {
+    DirlistIndex *list = &dirlist->lists[kind];
+
+    VarEntry *ve = tifiles_ve_create();
+    *ve = *src;
+    ve->data = NULL;
+
+    g_ptr_array_add(list->entries, ve);
+}
+
+static void build_index(Dirlist* dirlist) {
+    for(int i = 0; i < DIRLIST_COUNT; i++) {
+        DirlistIndex *list = &dirlist->lists[i];
+        g_ptr_array_sort(list->entries, compare_entries);
+
+        for(guint j = 0; j < list->entries->len; j++) {
+            VarEntry *ve = g_ptr_array_index(list->entries, j);
+            g_hash_table_replace(list->by_key, entry_key(ve->name, ve->type), ve);
+
+            // Keys are borrowed from the entries, which outlive the table
+            GSList *same = g_hash_table_lookup(list->by_name, ve->name);
+            if(same) {
+                g_slist_append(same, ve);
+            }
+            else {
+                g_hash_table_insert(list->by_name, ve->name, g_slist_append(NULL, ve));
+            }
+        }
+    }
+}
+
+static void add_tree(Dirlist* dirlist, DIRLIST_KIND kind, GNode* tree) {
+    if(tree == NULL) {
+        return;
+    }
+
+    // Folders, then the variables in them
+    for(GNode *folder = g_node_first_child(tree); folder; folder = g_node_next_sibling(folder)) {
+        for(GNode *child = g_node_first_child(folder); child; child = g_node_next_sibling(child)) {
+            if(child->data != NULL) {
+                add_entry(dirlist, kind, child->data);
+            }
+        }
+    }
+}
+
+static Dirlist* fetch(CalcSession* session) {
+    GNode *trees[DIRLIST_COUNT] = { NULL };
+    int err = 0;
+
+    for(int i = 0; i < DIRLIST_RETRIES; i++) {
+        if(!(err = ticalcs_calc_get_dirlist(session->calc, &trees[DIRLIST_VARS], &trees[DIRLIST_APPS]))) {
+            break;
+        }
+        log(LEVEL_DEBUG, "Retrying dirlist: %d\n", err);
+    }
+
+    if(err) {
+        log(LEVEL_ERROR, "Could not get the dirlist: %d\n", err);
+        return NULL;
+    }
+
+    Dirlist *dirlist = dirlist_new(session->model);
+    for(int i = 0; i < DIRLIST_COUNT; i++) {
+        add_tree(dirlist, i, trees[i]);
+        ticalcs_dirlist_destroy(&trees[i]);
+    }
+    build_index(dirlist);
+
+    return dirlist;
+}
+
+static bool get_memfree(CalcSession* session, uint32_t* ram, uint32_t* flash) {
+    int err = ticalcs_calc_get_memfree(session->calc, ram, flash);
+    if(err) {
+        log(LEVEL_DEBUG, "Could not get free memory, not using the dirlist cache: %d\n", err);
+        return false;
+    }
+
+    return true;
+}
+
+static Dirlist* load_cache(CalcSession* session, uint32_t ram, uint32_t flash) {
+    gchar *contents = NULL;
+    if(!g_file_get_contents(session->dirlist_cache, &contents, NULL, NULL)) {
+        return NULL;
+    }
+
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    char magic[16];
+    unsigned int version, model;
+    uint32_t cached_ram, cached_flash;
+    if(
+        lines[0] == NULL
+        || sscanf(lines[0], "%15s %u %u %u %u", magic, &version, &model, &cached_ram, &cached_flash) != 5
+        || strcmp(magic, DIRLIST_CACHE_MAGIC) != 0
+        || version != DIRLIST_CACHE_VERSION
+    ) {
+        log(LEVEL_WARN, "Ignoring invalid dirlist cache: %s\n", session->dirlist_cache);
+        g_strfreev(lines);
+        return NULL;
+    }
+
+    if(model != session->model || cached_ram != ram || cached_flash != flash) {
+        log(LEVEL_DEBUG, "Dirlist cache is stale\n");
+        g_strfreev(lines);
+        return NULL;
+    }
+
+    Dirlist *dirlist = dirlist_new(session->model);
+    for(int i = 1; lines[i] != NULL; i++) {
+        if(lines[i][0] == '\0') {
+            continue;
+        }
+
+        gchar **fields = g_strsplit(lines[i], "\t", 7);
+        unsigned int kind, type, attr, ver, size;
+        if(
+            g_strv_length(fields) != 7
+            || sscanf(fields[0], "%u", &kind) != 1 || kind >= DIRLIST_COUNT
+            || sscanf(fields[1], "%x", &type) != 1
+            || sscanf(fields[2], "%x", &attr) != 1
+            || sscanf(fields[3], "%u", &ver) != 1
+            || sscanf(fields[4], "%u", &size) != 1
+        ) {
+            log(LEVEL_WARN, "Ignoring invalid dirlist cache: %s\n", session->dirlist_cache);
+            g_strfreev(fields);
+            g_strfreev(lines);
+            dirlist_free(dirlist);
+            return NULL;
+        }
+
+        VarEntry ve = { 0 };
+        gchar *folder = g_strcompress(fields[5]);
+        gchar *name = g_strcompress(fields[6]);
+        g_strlcpy(ve.folder, folder, sizeof(ve.folder));
+        g_strlcpy(ve.name, name, sizeof(ve.name));
+        ve.type = type;
+        ve.attr = attr;
+        ve.version = ver;
+        ve.size = size;
+        add_entry(dirlist, kind, &ve);
+
+        g_free(folder);
+        g_free(name);
+        g_strfreev(fields);
+    }
+    g_strfreev(lines);
+
+    build_index(dirlist);
+    dirlist->cached = true;
+    return dirlist;
+}
+
+static void save_cache(CalcSession* session, Dirlist* dirlist, uint32_t ram, uint32_t flash) {
+    GString *out = g_string_new(NULL);
+    g_string_append_printf(out, "%s %u %u %u %u\n", DIRLIST_CACHE_MAGIC, DIRLIST_CACHE_VERSION, session->model, ram, flash);
+
+    for(int i = 0; i < DIRLIST_COUNT; i++) {
+        GPtrArray *entries = dirlist->lists[i].entries;
+        for(guint j = 0; j < entries->len; j++) {
+            VarEntry *ve = g_ptr_array_index(entries, j);
+            // Names can hold any byte, so escape them to keep one per line
+            gchar *folder = g_strescape(ve->folder, NULL);
+            gchar *name = g_strescape(ve->name, NULL);
+            g_string_append_printf(
+                out, "%d\t%02x\t%02x\t%u\t%u\t%s\t%s\n",
+                i, ve->type, ve->attr, ve->version, ve->size, folder, name
+            );
+            g_free(folder);
+            g_free(name);
+        }
+    }
+
+    GError *error = NULL;
+    if(!g_file_set_contents(session->dirlist_cache, out->str, out->len, &error)) {
+        log(LEVEL_WARN, "Could not write dirlist cache: %s\n", error->message);
+        g_error_free(error);
+    }
+    g_string_free(out, TRUE);
+}
+
+static Dirlist* get(CalcSession* session, bool use_cache) {
+    if(session->dirlist) {
+        return session->dirlist;
+    }
+
+    uint32_t ram = 0, flash = 0;
+    bool cacheable = session->dirlist_cache && get_memfree(session, &ram, &flash);
+
+    if(use_cache && cacheable && (session->dirlist = load_cache(session, ram, flash))) {
+        log(LEVEL_DEBUG, "Got dirlist from cache\n");
+        return session->dirlist;
+    }
+
+    session->dirlist = fetch(session);
+    if(session->dirlist == NULL) {
+        return NULL;
+    }
+
+    log(LEVEL_DEBUG, "Got dirlist\n");
+
+    if(cacheable) {
+        save_cache(session, session->dirlist, ram, flash);
+    }
+
+    return session->dirlist;
+}
+
+Dirlist* dirlist_get(CalcSession* session) {
+    return get(session, true);
+}
+
+Dirlist* dirlist_get_fresh(CalcSession* session) {
+    if(session->dirlist && session->dirlist->cached) {
+        dirlist_invalidate(session);
+    }
+    return get(session, false);
+}
+
+void dirlist_invalidate(CalcSession* session) {
+    dirlist_free(session->dirlist);
+    session->dirlist = NULL;
+}
+
+VarEntry* dirlist_find(Dirlist* dirlist, DIRLIST_KIND kind, const char* name) {
+    const GSList *same = dirlist_find_all(dirlist, kind, name);
+    return same ? same->data : NULL;
+}
+
+VarEntry* dirlist_find_type(Dirlist* dirlist, DIRLIST_KIND kind, const char* name, uint8_t type) {
+    char *key = entry_key(name, type);
+    VarEntry *ve = g_hash_table_lookup(dirlist->lists[kind].by_key, key);
+    g_free(key);
+    return ve;
+}
+
+const GSList* dirlist_find_all(Dirlist* dirlist, DIRLIST_KIND kind, const char* name) {
+    return g_hash_table_lookup(dirlist->lists[kind].by_name, name);
+}
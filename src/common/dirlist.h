@@ -0,0 +1,71 @@
+#ifndef __COMMON_DIRLIST_H__
+#define __COMMON_DIRLIST_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib-2.0/glib.h>
+#include <tilp2/tifiles.h>
+
+#include "calc.h"
+
+#define DIRLIST_RETRIES 5
+
+typedef enum {
+    DIRLIST_VARS,
+    DIRLIST_APPS,
+    DIRLIST_COUNT,
+} DIRLIST_KIND;
+
+typedef struct {
+    // VarEntry*, sorted by name
+    GPtrArray *entries;
+    // "TT:NAME" -> VarEntry*
+    GHashTable *by_key;
+    // NAME -> GSList of VarEntry*, one per type
+    GHashTable *by_name;
+} DirlistIndex;
+
+struct Dirlist {
+    CalcModel model;
+    // Loaded from the dirlist cache rather than the calculator
+    bool cached;
+    DirlistIndex lists[DIRLIST_COUNT];
+};
+
+/**
+ * The calculator's variables and apps, fetched once per session.
+ *
+ * If the session has a dirlist_cache path, the listing is loaded from there
+ * when the calculator's free RAM and flash still match what was recorded
+ * with it, and written back after every fresh fetch. Free memory can't tell
+ * a variable from another of the same size, so the cache is only good for
+ * lookups that can cope with being wrong.
+ *
+ * Returns NULL if the listing couldn't be fetched.
+ */
+Dirlist* dirlist_get(CalcSession* session);
+
+/**
+ * Like dirlist_get, but never from the cache, for callers that act on the
+ * whole listing, such as computing a menu key path or taking a snapshot.
+ */
+Dirlist* dirlist_get_fresh(CalcSession* session);
+
+/**
+ * Forget the session's listing, such as after running a program that may
+ * have created or deleted variables.
+ */
+void dirlist_invalidate(CalcSession* session);
+
+void dirlist_free(Dirlist* dirlist);
+
+VarEntry* dirlist_find(Dirlist* dirlist, DIRLIST_KIND kind, const char* name);
+
+VarEntry* dirlist_find_type(Dirlist* dirlist, DIRLIST_KIND kind, const char* name, uint8_t type);
+
+/**
+ * Every entry with this name, whatever its type. Owned by the dirlist.
+ */
+const GSList* dirlist_find_all(Dirlist* dirlist, DIRLIST_KIND kind, const char* name);
+
+#endif
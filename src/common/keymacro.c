@@ -0,0 +1,347 @@
+#include "keymacro.h"
+
+#include <ctype.h>
+#include <unistd.h>
+#include <glib-2.0/glib.h>
+#include <tilp2/keys83p.h>
+
+#include "utils.h"
+
+typedef struct {
+    const char *name;
+    uint16_t key;
+} KeyName;
+
+static const KeyName names_83p[] = {
+    {"RIGHT", KEY83P_Right},
+    {"LEFT", KEY83P_Left},
+    {"UP", KEY83P_Up},
+    {"DOWN", KEY83P_Down},
+    {"ENTER", KEY83P_Enter},
+    {"CLEAR", KEY83P_Clear},
+    {"DEL", KEY83P_Del},
+    {"INS", KEY83P_Ins},
+    {"QUIT", KEY83P_Quit},
+    {"MEM", KEY83P_Mem},
+    {"PRGM", KEY83P_Prgm},
+    {"APPS", KEY83P_AppsMenu},
+    {"MODE", KEY83P_Mode},
+    {"VARS", KEY83P_Vars},
+    {"MATH", KEY83P_Math},
+    {"MATRIX", KEY83P_Matrix},
+    {"STAT", KEY83P_Stat},
+    {"GRAPH", KEY83P_Graph},
+    {"TRACE", KEY83P_Trace},
+    {"ZOOM", KEY83P_Zoom},
+    {"WINDOW", KEY83P_Window},
+    {"YEQU", KEY83P_YEqu},
+    {"ADD", KEY83P_Add},
+    {"SUB", KEY83P_Sub},
+    {"MUL", KEY83P_Mul},
+    {"DIV", KEY83P_Div},
+    {"LPAREN", KEY83P_LParen},
+    {"RPAREN", KEY83P_RParen},
+    {"COMMA", KEY83P_Comma},
+    {"CHS", KEY83P_Chs},
+    {"DECPNT", KEY83P_DecPnt},
+    {"POWER", KEY83P_Power},
+    {"ANS", KEY83P_Ans},
+    {"RESETMEM", KEY83P_ResetMem},
+};
+
+typedef struct {
+    // Upper case name -> key
+    GHashTable *names;
+    // 0 where the character can't be typed
+    uint32_t ascii[128];
+} KeyTable;
+
+// CalcModel -> KeyTable*
+static GHashTable *tables = NULL;
+// "MODEL:SOURCE" -> KeyMacro*
+static GHashTable *compiled = NULL;
+// Past this many, macros are compiled for one run and not kept. The built-in
+// ones are played first and repeatedly, so they're the ones that get kept.
+#define COMPILED_MAX 64
+// Guards both tables, for sessions on other threads
+static GMutex lock;
+
+static KeyTable* get_table(CalcSession* session) {
+    const KeyName *names = NULL;
+    size_t name_count = 0;
+
+    switch(session->model) {
+        case CALC_TI83P:
+        case CALC_TI84P:
+        case CALC_TI84P_USB:
+        case CALC_TI84PC:
+        case CALC_TI84PC_USB:
+            names = names_83p;
+            name_count = sizeof(names_83p) / sizeof(names_83p[0]);
+            break;
+        default:
+            break;
+    }
+
+    if(names == NULL || session->keys_func == NULL) {
+        log(LEVEL_ERROR, "No key macros for this model\n");
+        return NULL;
+    }
+
+    if(tables == NULL) {
+        tables = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    KeyTable *table = g_hash_table_lookup(tables, GINT_TO_POINTER(session->model));
+    if(table) {
+        return table;
+    }
+
+    table = g_new0(KeyTable, 1);
+    table->names = g_hash_table_new(g_str_hash, g_str_equal);
+    for(size_t i = 0; i < name_count; i++) {
+        g_hash_table_insert(table->names, (gpointer)names[i].name, GUINT_TO_POINTER(names[i].key));
+    }
+    for(int c = 1; c < 128; c++) {
+        table->ascii[c] = calc_ascii_key(session, c);
+    }
+
+    g_hash_table_insert(tables, GINT_TO_POINTER(session->model), table);
+    return table;
+}
+
+static void push_step(KeyMacro* macro, size_t* capacity, uint8_t op, uint32_t value, bool retry) {
+    if(macro->count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        macro->steps = realloc(macro->steps, *capacity * sizeof(MacroStep));
+    }
+
+    MacroStep *step = &macro->steps[macro->count++];
+    step->op = op;
+    step->value = value;
+    step->retry = retry;
+}
+
+static int line_of(const char* source, const char* at) {
+    int line = 1;
+    for(const char *p = source; p < at; p++) {
+        if(*p == '\n') {
+            line++;
+        }
+    }
+    return line;
+}
+
+static bool is_end(char c) {
+    return c == '\0' || c == '#' || isspace((unsigned char)c);
+}
+
+KeyMacro* keymacro_compile(CalcSession* session, const char* source) {
+    g_mutex_lock(&lock);
+    KeyTable *table = get_table(session);
+    g_mutex_unlock(&lock);
+    if(table == NULL) {
+        return NULL;
+    }
+
+    KeyMacro *macro = calloc(1, sizeof(KeyMacro));
+    size_t capacity = 0;
+    const char *error = NULL;
+    const char *p = source;
+    const char *start = p;
+
+    while(*p) {
+        if(isspace((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+
+        if(*p == '#') {
+            while(*p && *p != '\n') {
+                p++;
+            }
+            continue;
+        }
+
+        start = p;
+        size_t first = macro->count;
+
+        if(*p == '\'') {
+            unsigned char c = p[1];
+            if(c == '\0' || p[2] != '\'') {
+                error = "Expected a single character in quotes";
+                break;
+            }
+            if(c >= 128 || !table->ascii[c]) {
+                error = "Character can't be typed";
+                break;
+            }
+            push_step(macro, &capacity, MACRO_KEY, table->ascii[c], true);
+            p += 3;
+        }
+        else if(*p == '"') {
+            for(p++; *p && *p != '"'; p++) {
+                unsigned char c = *p;
+                if(c >= 128 || !table->ascii[c]) {
+                    error = "Character can't be typed";
+                    break;
+                }
+                push_step(macro, &capacity, MACRO_KEY, table->ascii[c], true);
+            }
+            if(error) {
+                break;
+            }
+            if(*p != '"') {
+                error = "Unterminated string";
+                break;
+            }
+            p++;
+        }
+        else if(isalnum((unsigned char)*p) || *p == '_') {
+            char name[32];
+            size_t len = 0;
+            while(isalnum((unsigned char)*p) || *p == '_') {
+                if(len < sizeof(name) - 1) {
+                    name[len++] = toupper((unsigned char)*p);
+                }
+                p++;
+            }
+            name[len] = '\0';
+
+            if(*p == '(') {
+                char *end;
+                unsigned long value = strtoul(p + 1, &end, 10);
+                if(end == p + 1 || *end != ')') {
+                    error = "Expected a number in parentheses";
+                    break;
+                }
+                p = end + 1;
+
+                if(strcmp(name, "WAIT") == 0) {
+                    push_step(macro, &capacity, MACRO_WAIT, value, false);
+                }
+                else if(strcmp(name, "TIMEOUT") == 0) {
+                    push_step(macro, &capacity, MACRO_TIMEOUT, value, false);
+                }
+                else {
+                    error = "Unknown directive";
+                    break;
+                }
+
+                if(!is_end(*p)) {
+                    error = "Unexpected character";
+                    break;
+                }
+                continue;
+            }
+
+            gpointer key;
+            if(!g_hash_table_lookup_extended(table->names, name, NULL, &key)) {
+                error = "Unknown key";
+                break;
+            }
+            push_step(macro, &capacity, MACRO_KEY, GPOINTER_TO_UINT(key), true);
+        }
+        else {
+            error = "Unexpected character";
+            break;
+        }
+
+        if(*p == '!') {
+            for(size_t i = first; i < macro->count; i++) {
+                macro->steps[i].retry = false;
+            }
+            p++;
+        }
+
+        if(!is_end(*p)) {
+            error = "Unexpected character";
+            break;
+        }
+    }
+
+    if(error) {
+        log(LEVEL_ERROR, "Key macro line %d: %s: %.16s\n", line_of(source, start), error, start);
+        keymacro_free(macro);
+        return NULL;
+    }
+
+    return macro;
+}
+
+void keymacro_free(KeyMacro* macro) {
+    if(macro) {
+        free(macro->steps);
+        free(macro);
+    }
+}
+
+int keymacro_run(CalcSession* session, const KeyMacro* macro) {
+    // timeout() only lasts for the macro
+    int timeout = session->cable->timeout;
+    int err = 0;
+
+    for(size_t i = 0; i < macro->count && !err; i++) {
+        const MacroStep *step = &macro->steps[i];
+        if(step->op == MACRO_KEY) {
+            int key_err = calc_send_key(session, step->value, step->retry);
+            if(step->retry) {
+                err = key_err;
+            }
+        }
+        else if(step->op == MACRO_WAIT) {
+            usleep(step->value * 1000);
+        }
+        else if(step->op == MACRO_TIMEOUT) {
+            ticables_options_set_timeout(session->cable, step->value);
+        }
+    }
+
+    ticables_options_set_timeout(session->cable, timeout);
+    return err;
+}
+
+int keymacro_play(CalcSession* session, const char* source) {
+    g_mutex_lock(&lock);
+    if(compiled == NULL) {
+        compiled = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)keymacro_free);
+    }
+
+    char *key = g_strdup_printf("%d:%s", session->model, source);
+    KeyMacro *macro = g_hash_table_lookup(compiled, key);
+    g_mutex_unlock(&lock);
+    if(macro) {
+        g_free(key);
+        // Compiled macros are never freed, so this is safe unlocked
+        return keymacro_run(session, macro);
+    }
+
+    macro = keymacro_compile(session, source);
+    if(macro == NULL) {
+        g_free(key);
+        return -1;
+    }
+
+    g_mutex_lock(&lock);
+    KeyMacro *kept = g_hash_table_lookup(compiled, key);
+    if(kept == NULL && g_hash_table_size(compiled) < COMPILED_MAX) {
+        g_hash_table_insert(compiled, key, macro);
+        kept = macro;
+        key = NULL;
+    }
+    g_mutex_unlock(&lock);
+    g_free(key);
+
+    if(kept) {
+        if(kept != macro) {
+            // Another session compiled it first
+            keymacro_free(macro);
+        }
+        return keymacro_run(session, kept);
+    }
+
+    // The cache is full, so this copy is only for this run
+    int err = keymacro_run(session, macro);
+    keymacro_free(macro);
+    return err;
+}
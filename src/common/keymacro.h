@@ -0,0 +1,60 @@
+#ifndef __COMMON_KEYMACRO_H__
+#define __COMMON_KEYMACRO_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "calc.h"
+
+typedef enum {
+    MACRO_KEY,
+    MACRO_WAIT,
+    MACRO_TIMEOUT,
+} MACRO_OP;
+
+typedef struct {
+    uint8_t op;
+    uint8_t retry;
+    uint32_t value;
+} MacroStep;
+
+typedef struct {
+    MacroStep *steps;
+    size_t count;
+} KeyMacro;
+
+/**
+ * Compile a key macro for the session's model. Tokens are separated by
+ * whitespace, and # starts a comment that runs to the end of the line.
+ *
+ *   QUIT CLEAR PRGM    a key by name, any case
+ *   'A'                the key that types a character
+ *   "NOSHELL"          the keys that type a string
+ *   wait(200)          pause for some milliseconds
+ *   timeout(2)         set the cable timeout, in tenths of a second,
+ *                      until the end of the macro
+ *
+ * Keys are retried until they're ACKed. A ! right after a key, character or
+ * string sends it once and doesn't wait for it to go through, for keys that
+ * start something that won't ACK until it's done.
+ *
+ * Returns NULL and logs where the script is wrong if it doesn't compile.
+ */
+KeyMacro* keymacro_compile(CalcSession* session, const char* source);
+
+void keymacro_free(KeyMacro* macro);
+
+/**
+ * Returns the error from the first key that couldn't be sent, or 0.
+ */
+int keymacro_run(CalcSession* session, const KeyMacro* macro);
+
+/**
+ * Compile and run a macro, keeping the compiled copy for next time. Only
+ * the first few distinct macros are kept, so the cache stays small when
+ * every call brings a new script.
+ */
+int keymacro_play(CalcSession* session, const char* source);
+
+#endif
@@ -0,0 +1,158 @@
+#include "launch.h"
+
+#include <tilp2/keys83p.h>
+
+#include "utils.h"
+#include "dirlist.h"
+#include "keymacro.h"
+#include "menu.h"
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+// Back to an empty home screen
+static const char *macro_home = "QUIT CLEAR";
+// Start ion from the program menu
+static const char *macro_ion = "PRGM 'A' ENTER ENTER!";
+// Let noshell's menu check that its hook is installed
+static const char *macro_noshell_hook =
+    "timeout(" XSTR(CABLE_FAST_TIMEOUT) ") '1'! ENTER! '6'!";
+
+int launch_start_app(CalcSession* session, DIRLIST_KIND kind, const char *app_name, bool is_program, bool detach) {
+    static const CalcModel allowed_models[] = {
+        CALC_TI83,
+        CALC_TI83P,
+        CALC_TI84P,
+        CALC_TI84P_USB,
+        CALC_TI84PC,
+        CALC_TI84PC_USB,
+        CALC_TI83PCE_USB,
+        CALC_TI84PCE_USB,
+        CALC_TI84PT_USB,
+    };
+
+    CalcModel model = session->model;
+    Dirlist *dirlist = dirlist_get(session);
+    if(dirlist == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    bool is_ti8x = false;
+    for(int i = 0; i < sizeof(allowed_models)/sizeof(allowed_models[0]); i++) {
+        if(allowed_models[i] == model) {
+            is_ti8x = true;
+            break;
+        }
+    }
+
+    // We use my function for apps on TI8x, and the builtin for programs
+    // unless the caller wants the link to itself once the program starts
+    if((is_program && !detach) || !is_ti8x) {
+        VarEntry *found = dirlist_find(dirlist, kind, app_name);
+        if(found == NULL) {
+            return EXIT_FAILURE;
+        }
+
+        // Work on a copy so the remap doesn't leak into the dirlist
+        VarEntry app = *found;
+        if(is_ti8x && strcmp(tifiles_vartype2string(model, app.type), "PPRGM") == 0) {
+            // We remap TI8x assembly programs so noshell can do its work
+            // it doesn't like the Asm( token
+            app.type = tifiles_string2vartype(model, "PRGM");
+        }
+
+        ticalcs_calc_execute(session->calc, &app, "");
+
+        return EXIT_SUCCESS;
+    }
+
+    // A cached listing could be off by an entry, which picks the wrong one
+    if(dirlist->cached && (dirlist = dirlist_get_fresh(session)) == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    int count;
+    uint32_t *path = menu_path(session, dirlist, is_program ? MENU_PRGM : MENU_APPS, app_name, &count);
+    if(path == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    // The pick may start the app, which won't ACK until it's done
+    for(int i = 0; i < count; i++) {
+        calc_send_key(session, path[i], i < count - 1);
+    }
+    free(path);
+
+    if(is_program && (!detach || calc_send_key_raw(session, KEY83P_Enter))) {
+        calc_send_key(session, KEY83P_Enter, 0);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int launch_home(CalcSession* session) {
+    return keymacro_play(session, macro_home);
+}
+
+int launch_program(CalcSession* session, const char* subtype, const char* program, bool detach) {
+    int err;
+
+    if((err = launch_home(session))) {
+        log(LEVEL_ERROR, "Could not get to the home screen: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    if(strcmp(subtype, "asm") == 0) {
+        log(LEVEL_ERROR, "asm is not supported! Start it manually!\n");
+        return EXIT_FAILURE;
+    }
+    else if(strcmp(subtype, "tse") == 0) {
+        log(LEVEL_ERROR, "tse is not supported! Start it manually!\n");
+        return EXIT_FAILURE;
+    }
+    else if(strcmp(subtype, "ion") == 0) {
+        log(LEVEL_WARN, "ion will be started, but you still need to start the program yourself.\n");
+        keymacro_play(session, macro_ion);
+    }
+    else if(strcmp(subtype, "mirage") == 0) {
+        log(LEVEL_WARN, "Mirage will be started, but you still need to start the program yourself.\n");
+
+        if((err = launch_start_app(session, DIRLIST_APPS, "MirageOS", 0, 0))) {
+            log(LEVEL_ERROR, "Could not start MirageOS. Is it installed?\n");
+            return EXIT_FAILURE;
+        }
+    }
+    else if(strlen(program) > 0) {
+        if(strcmp(subtype, "noshell") != 0) {
+            log(LEVEL_WARN, "Subtype was not recognized! It will be started with noshell!\n");
+        }
+
+        Dirlist *dirlist = dirlist_get(session);
+        if(dirlist == NULL) {
+            return EXIT_FAILURE;
+        }
+
+        if(dirlist_find(dirlist, DIRLIST_VARS, program) == NULL) {
+            log(LEVEL_ERROR, "Could not find %s. Is it installed?\n", program);
+            return EXIT_FAILURE;
+        }
+
+        log(LEVEL_INFO, "Verifying that noshell is correctly hooked.\n");
+
+        if((err = launch_start_app(session, DIRLIST_APPS, "Noshell ", 0, 0))) {
+            log(LEVEL_ERROR, "Could not start Noshell. Is it installed?\n");
+            return EXIT_FAILURE;
+        }
+
+        keymacro_play(session, macro_noshell_hook);
+
+        if((err = launch_start_app(session, DIRLIST_VARS, program, 1, detach))) {
+            log(LEVEL_ERROR, "Could not start %s. Is it installed? Error %d\n", program, err);
+            return EXIT_FAILURE;
+        }
+
+        log(LEVEL_INFO, "Finished sucessfully!\n");
+    }
+
+    return EXIT_SUCCESS;
+}
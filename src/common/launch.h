@@ -0,0 +1,28 @@
+#ifndef __COMMON_LAUNCH_H__
+#define __COMMON_LAUNCH_H__
+
+#include <stdbool.h>
+
+#include "calc.h"
+#include "dirlist.h"
+
+/**
+ * Start an app or program. With detach, a program on a TI8x is picked from
+ * the PRGM menu and the final Enter is sent raw, so whatever it sends first
+ * is left on the link instead of being read as the OS's ACK.
+ */
+int launch_start_app(CalcSession* session, DIRLIST_KIND kind, const char* app_name, bool is_program, bool detach);
+
+/**
+ * Quit to an empty home screen, where the OS takes link transfers.
+ */
+int launch_home(CalcSession* session);
+
+/**
+ * Start a program from the home screen, going through a shell if the subtype
+ * needs one. See launch_start_app for detach. Returns EXIT_SUCCESS or
+ * EXIT_FAILURE.
+ */
+int launch_program(CalcSession* session, const char* subtype, const char* program, bool detach);
+
+#endif
@@ -0,0 +1,136 @@
+#include "menu.h"
+
+#include <tilp2/keys83p.h>
+#include <tilp2/tifiles.h>
+
+#include "utils.h"
+
+#define MENU_HOTKEYS 10
+
+static const char *finance = "Finance";
+
+static bool is_launchable(CalcModel model, const VarEntry* ve) {
+    const char *str_type = tifiles_vartype2string(model, ve->type);
+    size_t len = strlen(str_type);
+    return len >= 4 && (
+        strcmp(&str_type[len - 4], "PRGM") == 0
+        || strcmp(str_type, "APPL") == 0
+    );
+}
+
+/**
+ * Entry names in the order the menu shows them. Borrowed from the dirlist.
+ */
+static const char** menu_entries(Dirlist* dirlist, MENU_KIND kind, int* count) {
+    GPtrArray *entries = dirlist->lists[kind == MENU_APPS ? DIRLIST_APPS : DIRLIST_VARS].entries;
+    const char **names = malloc((entries->len + 1) * sizeof(char*));
+    int n = 0;
+
+    if(kind == MENU_APPS) {
+        names[n++] = finance;
+    }
+
+    // The dirlist is already sorted by name
+    for(guint i = 0; i < entries->len; i++) {
+        VarEntry *ve = g_ptr_array_index(entries, i);
+        if(is_launchable(dirlist->model, ve)) {
+            names[n++] = ve->name;
+        }
+    }
+
+    *count = n;
+    return names;
+}
+
+uint32_t* menu_path(CalcSession* session, Dirlist* dirlist, MENU_KIND kind, const char* name, int* count) {
+    int n;
+    const char **names = menu_entries(dirlist, kind, &n);
+
+    int target = -1;
+    for(int i = 0; i < n; i++) {
+        if(strcmp(names[i], name) == 0) {
+            target = i;
+            break;
+        }
+    }
+    if(target == -1) {
+        free(names);
+        return NULL;
+    }
+
+    // Where each letter jumps to
+    int jump[256];
+    for(int c = 0; c < 256; c++) {
+        jump[c] = -1;
+    }
+    for(int i = n - 1; i >= 0; i--) {
+        unsigned char c = names[i][0];
+        if(calc_ascii_key(session, c)) {
+            jump[c] = i;
+        }
+    }
+
+    // Breadth first from the first entry, remembering how we got to each
+    int *prev = malloc(n * sizeof(int));
+    uint32_t *prev_key = malloc(n * sizeof(uint32_t));
+    int *dist = malloc(n * sizeof(int));
+    int *queue = malloc(n * sizeof(int));
+    for(int i = 0; i < n; i++) {
+        dist[i] = -1;
+    }
+
+    int head = 0, tail = 0;
+    dist[0] = 0;
+    prev[0] = -1;
+    queue[tail++] = 0;
+
+    while(head < tail && dist[target] == -1) {
+        int at = queue[head++];
+        int next[2 + 256];
+        uint32_t keys[2 + 256];
+        int moves = 0;
+
+        next[moves] = (at + 1) % n;
+        keys[moves++] = KEY83P_Down;
+        next[moves] = (at + n - 1) % n;
+        keys[moves++] = KEY83P_Up;
+        for(int c = 0; c < 256; c++) {
+            if(jump[c] != -1) {
+                next[moves] = jump[c];
+                keys[moves++] = calc_ascii_key(session, c);
+            }
+        }
+
+        for(int m = 0; m < moves; m++) {
+            if(dist[next[m]] == -1) {
+                dist[next[m]] = dist[at] + 1;
+                prev[next[m]] = at;
+                prev_key[next[m]] = keys[m];
+                queue[tail++] = next[m];
+            }
+        }
+    }
+
+    // The menu key, the moves, then the pick
+    uint32_t hotkey = 0;
+    if(target < MENU_HOTKEYS) {
+        hotkey = calc_ascii_key(session, target == MENU_HOTKEYS - 1 ? '0' : '1' + target);
+    }
+    int moves = hotkey ? 0 : dist[target];
+    uint32_t *path = malloc((moves + 2) * sizeof(uint32_t));
+    path[0] = kind == MENU_APPS ? KEY83P_AppsMenu : KEY83P_Prgm;
+    for(int at = target, i = moves; i > 0; at = prev[at], i--) {
+        path[i] = prev_key[at];
+    }
+    path[moves + 1] = hotkey ? hotkey : KEY83P_Enter;
+    *count = moves + 2;
+
+    log(LEVEL_DEBUG, "%s is entry %d, %d keys away\n", name, target, *count);
+
+    free(queue);
+    free(dist);
+    free(prev_key);
+    free(prev);
+    free(names);
+    return path;
+}
@@ -0,0 +1,33 @@
+#ifndef __COMMON_MENU_H__
+#define __COMMON_MENU_H__
+
+#include <stdint.h>
+
+#include "calc.h"
+#include "dirlist.h"
+
+typedef enum {
+    MENU_APPS,
+    MENU_PRGM,
+} MENU_KIND;
+
+/**
+ * The fewest keys that open a menu and pick an entry from it, found by a
+ * breadth first search over the menu as the OS draws it:
+ *
+ * - APPS has Finance pinned first, then the apps by name. PRGM EXEC lists
+ *   the programs by name.
+ * - The cursor starts on the first entry, and Up and Down wrap around.
+ * - A letter moves the cursor to the first entry starting with it.
+ * - The first ten entries have the hotkeys 1-9 and 0, which pick them
+ *   right away. Any other entry is picked with Enter.
+ *
+ * The menus scroll a line at a time, and there are no paging keys on the
+ * 83+ family, so paging doesn't change the cost.
+ *
+ * Returns the keys to send, the last of which picks the entry, or NULL if
+ * the entry isn't in the menu. Free with free().
+ */
+uint32_t* menu_path(CalcSession* session, Dirlist* dirlist, MENU_KIND kind, const char* name, int* count);
+
+#endif
@@ -0,0 +1,62 @@
+#include "screen.h"
+
+#include <stdio.h>
+
+#include "utils.h"
+
+int screen_capture(CalcSession* session, CalcScreenCoord* sc, uint8_t** bitmap) {
+    sc->format = SCREEN_FULL;
+    int err = ticalcs_calc_recv_screen(session->calc, sc, bitmap);
+    if(err) {
+        log(LEVEL_ERROR, "Could not capture the screen: %d\n", err);
+    }
+    return err;
+}
+
+unsigned int screen_row_bytes(const CalcScreenCoord* sc) {
+    switch(sc->pixel_format) {
+        case CALC_PIXFMT_MONO:
+            return (sc->width + 7) / 8;
+        case CALC_PIXFMT_GRAY_4:
+            return (sc->width + 1) / 2;
+        case CALC_PIXFMT_RGB_565_LE:
+            return sc->width * 2;
+    }
+    return 0;
+}
+
+bool screen_write_pnm(const char* path, const CalcScreenCoord* sc, const uint8_t* bitmap) {
+    FILE *f = fopen(path, "wb");
+    if(f == NULL) {
+        log(LEVEL_ERROR, "Could not write screenshot: %s\n", path);
+        return false;
+    }
+
+    unsigned int row_bytes = screen_row_bytes(sc);
+    if(sc->pixel_format == CALC_PIXFMT_MONO) {
+        // PBM uses 1 for black, same as the LCD
+        fprintf(f, "P4\n%u %u\n", sc->width, sc->height);
+        fwrite(bitmap, row_bytes, sc->height, f);
+    }
+    else if(sc->pixel_format == CALC_PIXFMT_GRAY_4) {
+        fprintf(f, "P5\n%u %u\n15\n", sc->width, sc->height);
+        for(unsigned int y = 0; y < sc->height; y++) {
+            for(unsigned int x = 0; x < sc->width; x++) {
+                uint8_t b = bitmap[y * row_bytes + x / 2];
+                fputc(x % 2 ? b & 0xf : b >> 4, f);
+            }
+        }
+    }
+    else {
+        fprintf(f, "P6\n%u %u\n255\n", sc->width, sc->height);
+        for(unsigned int i = 0; i < sc->width * sc->height; i++) {
+            uint16_t px = bitmap[i * 2] | (bitmap[i * 2 + 1] << 8);
+            fputc(((px >> 11) & 0x1f) * 255 / 31, f);
+            fputc(((px >> 5) & 0x3f) * 255 / 63, f);
+            fputc((px & 0x1f) * 255 / 31, f);
+        }
+    }
+
+    fclose(f);
+    return true;
+}
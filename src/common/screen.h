@@ -0,0 +1,24 @@
+#ifndef __COMMON_SCREEN_H__
+#define __COMMON_SCREEN_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "calc.h"
+
+/**
+ * Grab the whole LCD. Free the bitmap with ticalcs_free_screen.
+ */
+int screen_capture(CalcSession* session, CalcScreenCoord* sc, uint8_t** bitmap);
+
+/**
+ * Bytes per row in the calculator's native pixel format.
+ */
+unsigned int screen_row_bytes(const CalcScreenCoord* sc);
+
+/**
+ * Write a native bitmap as PBM, PGM or PPM, whichever fits the pixel format.
+ */
+bool screen_write_pnm(const char* path, const CalcScreenCoord* sc, const uint8_t* bitmap);
+
+#endif
@@ -0,0 +1,394 @@
+#include "screenrec.h"
+
+#include <glib-2.0/glib.h>
+
+#include "utils.h"
+#include "screen.h"
+
+#define PNG_STORED_MAX 65535
+
+static void put_u16(FILE* f, uint16_t v) {
+    fputc(v & 0xff, f);
+    fputc(v >> 8, f);
+}
+
+static void put_u32(FILE* f, uint32_t v) {
+    put_u16(f, v & 0xffff);
+    put_u16(f, v >> 16);
+}
+
+static bool get_u16(FILE* f, uint16_t* v) {
+    int lo = fgetc(f), hi = fgetc(f);
+    if(lo == EOF || hi == EOF) {
+        return false;
+    }
+    *v = lo | (hi << 8);
+    return true;
+}
+
+static bool get_u32(FILE* f, uint32_t* v) {
+    uint16_t lo, hi;
+    if(!get_u16(f, &lo) || !get_u16(f, &hi)) {
+        return false;
+    }
+    *v = lo | ((uint32_t)hi << 16);
+    return true;
+}
+
+ScreenRecorder* screenrec_open(const char* path) {
+    FILE *f = fopen(path, "wb");
+    if(f == NULL) {
+        log(LEVEL_ERROR, "Could not write recording: %s\n", path);
+        return NULL;
+    }
+
+    ScreenRecorder *rec = calloc(1, sizeof(ScreenRecorder));
+    rec->file = f;
+    return rec;
+}
+
+bool screenrec_add(ScreenRecorder* rec, const CalcScreenCoord* sc, const uint8_t* bitmap) {
+    uint64_t now = utils_now_ms();
+
+    if(rec->last == NULL) {
+        rec->sc = *sc;
+        rec->row_bytes = screen_row_bytes(sc);
+        rec->last = malloc(rec->row_bytes * sc->height);
+        rec->started_at = now;
+
+        fwrite(SCREENREC_MAGIC, 1, 8, rec->file);
+        fputc(SCREENREC_VERSION, rec->file);
+        fputc(sc->pixel_format, rec->file);
+        put_u16(rec->file, sc->width);
+        put_u16(rec->file, sc->height);
+        put_u16(rec->file, rec->row_bytes);
+    }
+    else if(sc->width != rec->sc.width || sc->height != rec->sc.height || sc->pixel_format != rec->sc.pixel_format) {
+        log(LEVEL_ERROR, "The screen changed format while recording\n");
+        return false;
+    }
+
+    rec->frames++;
+
+    // Runs of rows that changed, or the whole screen the first time
+    uint16_t runs[sc->height][2];
+    int run_count = 0;
+    bool first = rec->written == 0;
+    for(unsigned int y = 0; y < sc->height; y++) {
+        size_t offset = y * rec->row_bytes;
+        if(!first && memcmp(&bitmap[offset], &rec->last[offset], rec->row_bytes) == 0) {
+            continue;
+        }
+
+        if(run_count > 0 && runs[run_count - 1][0] + runs[run_count - 1][1] == y) {
+            runs[run_count - 1][1]++;
+        }
+        else {
+            runs[run_count][0] = y;
+            runs[run_count][1] = 1;
+            run_count++;
+        }
+    }
+
+    if(run_count == 0) {
+        return true;
+    }
+
+    put_u32(rec->file, now - rec->started_at);
+    put_u16(rec->file, run_count);
+    for(int i = 0; i < run_count; i++) {
+        put_u16(rec->file, runs[i][0]);
+        put_u16(rec->file, runs[i][1]);
+        fwrite(&bitmap[runs[i][0] * rec->row_bytes], rec->row_bytes, runs[i][1], rec->file);
+    }
+
+    // So readers following the file see whole frames
+    fflush(rec->file);
+
+    memcpy(rec->last, bitmap, rec->row_bytes * sc->height);
+    rec->written++;
+    return true;
+}
+
+void screenrec_close(ScreenRecorder* rec) {
+    if(rec->last) {
+        put_u32(rec->file, utils_now_ms() - rec->started_at);
+        put_u16(rec->file, 0);
+    }
+
+    fclose(rec->file);
+    free(rec->last);
+    free(rec);
+}
+
+int screenrec_record(CalcSession* session, const char* path, uint64_t duration_ms) {
+    ScreenRecorder *rec = screenrec_open(path);
+    if(rec == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    uint64_t until = utils_now_ms() + duration_ms;
+    int result = EXIT_SUCCESS;
+    while(duration_ms == 0 || utils_now_ms() < until) {
+        CalcScreenCoord sc;
+        uint8_t *bitmap = NULL;
+        if(screen_capture(session, &sc, &bitmap)) {
+            // Running until the link fails is how an open ended recording stops
+            result = duration_ms == 0 && rec->written > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+
+        bool ok = screenrec_add(rec, &sc, bitmap);
+        ticalcs_free_screen(bitmap);
+        if(!ok) {
+            result = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    log(LEVEL_INFO, "Captured %lu frames, %lu changed\n", rec->frames, rec->written);
+    screenrec_close(rec);
+    return result;
+}
+
+static uint32_t crc_table[256];
+
+static uint32_t png_crc(uint32_t crc, const uint8_t* data, size_t len) {
+    if(crc_table[1] == 0) {
+        for(uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            crc_table[n] = c;
+        }
+    }
+
+    for(size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void put_be32(uint8_t* out, uint32_t v) {
+    out[0] = v >> 24;
+    out[1] = v >> 16;
+    out[2] = v >> 8;
+    out[3] = v;
+}
+
+static void png_chunk(FILE* f, const char* type, const uint8_t* data, uint32_t len) {
+    uint8_t word[4];
+    put_be32(word, len);
+    fwrite(word, 1, 4, f);
+    fwrite(type, 1, 4, f);
+    fwrite(data, 1, len, f);
+
+    uint32_t crc = png_crc(0xffffffff, (const uint8_t*)type, 4);
+    crc = png_crc(crc, data, len) ^ 0xffffffff;
+    put_be32(word, crc);
+    fwrite(word, 1, 4, f);
+}
+
+/**
+ * The screens are tiny, so the image data goes in stored (uncompressed)
+ * deflate blocks rather than pulling in zlib.
+ */
+static bool write_png(const char* path, const CalcScreenCoord* sc, unsigned int row_bytes, const uint8_t* bitmap) {
+    uint8_t depth, color;
+    unsigned int png_row;
+    if(sc->pixel_format == CALC_PIXFMT_MONO) {
+        depth = 1;
+        color = 0;
+        png_row = (sc->width + 7) / 8;
+    }
+    else if(sc->pixel_format == CALC_PIXFMT_GRAY_4) {
+        depth = 4;
+        color = 0;
+        png_row = (sc->width + 1) / 2;
+    }
+    else {
+        depth = 8;
+        color = 2;
+        png_row = sc->width * 3;
+    }
+
+    // Each row starts with filter type 0
+    size_t raw_len = (size_t)(png_row + 1) * sc->height;
+    uint8_t *raw = malloc(raw_len);
+    for(unsigned int y = 0; y < sc->height; y++) {
+        uint8_t *out = &raw[y * (png_row + 1)];
+        const uint8_t *in = &bitmap[y * row_bytes];
+        *out++ = 0;
+
+        if(sc->pixel_format == CALC_PIXFMT_MONO) {
+            // PNG uses 0 for black, the LCD uses 1
+            for(unsigned int i = 0; i < png_row; i++) {
+                out[i] = ~in[i];
+            }
+        }
+        else if(sc->pixel_format == CALC_PIXFMT_GRAY_4) {
+            memcpy(out, in, png_row);
+        }
+        else {
+            for(unsigned int x = 0; x < sc->width; x++) {
+                uint16_t px = in[x * 2] | (in[x * 2 + 1] << 8);
+                out[x * 3] = ((px >> 11) & 0x1f) * 255 / 31;
+                out[x * 3 + 1] = ((px >> 5) & 0x3f) * 255 / 63;
+                out[x * 3 + 2] = (px & 0x1f) * 255 / 31;
+            }
+        }
+    }
+
+    size_t blocks = raw_len / PNG_STORED_MAX + 1;
+    size_t idat_len = 2 + raw_len + blocks * 5 + 4;
+    uint8_t *idat = malloc(idat_len);
+    uint8_t *p = idat;
+    *p++ = 0x78;
+    *p++ = 0x01;
+
+    uint32_t a = 1, b = 0;
+    size_t left = raw_len;
+    const uint8_t *in = raw;
+    do {
+        uint16_t len = left > PNG_STORED_MAX ? PNG_STORED_MAX : left;
+        *p++ = left <= PNG_STORED_MAX;
+        *p++ = len & 0xff;
+        *p++ = len >> 8;
+        *p++ = ~len & 0xff;
+        *p++ = (~len >> 8) & 0xff;
+        memcpy(p, in, len);
+
+        for(uint16_t i = 0; i < len; i++) {
+            a = (a + in[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+
+        p += len;
+        in += len;
+        left -= len;
+    } while(left > 0);
+    put_be32(p, (b << 16) | a);
+    p += 4;
+
+    FILE *f = fopen(path, "wb");
+    if(f == NULL) {
+        log(LEVEL_ERROR, "Could not write %s\n", path);
+        free(idat);
+        free(raw);
+        return false;
+    }
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, 8, f);
+
+    uint8_t ihdr[13];
+    put_be32(&ihdr[0], sc->width);
+    put_be32(&ihdr[4], sc->height);
+    ihdr[8] = depth;
+    ihdr[9] = color;
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+    png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+    png_chunk(f, "IDAT", idat, p - idat);
+    png_chunk(f, "IEND", NULL, 0);
+
+    fclose(f);
+    free(idat);
+    free(raw);
+    return true;
+}
+
+bool screenrec_export_png(const char* path, const char* prefix) {
+    FILE *f = fopen(path, "rb");
+    if(f == NULL) {
+        log(LEVEL_ERROR, "Could not read recording: %s\n", path);
+        return false;
+    }
+
+    char magic[8];
+    int version, pixel_format;
+    uint16_t width, height, row_bytes;
+    if(
+        fread(magic, 1, 8, f) != 8
+        || memcmp(magic, SCREENREC_MAGIC, 8) != 0
+        || (version = fgetc(f)) != SCREENREC_VERSION
+        || (pixel_format = fgetc(f)) == EOF
+        || !get_u16(f, &width) || !get_u16(f, &height) || !get_u16(f, &row_bytes)
+    ) {
+        log(LEVEL_ERROR, "Not a screen recording: %s\n", path);
+        fclose(f);
+        return false;
+    }
+
+    CalcScreenCoord sc = { 0 };
+    sc.width = width;
+    sc.height = height;
+    sc.pixel_format = pixel_format;
+
+    uint8_t *frame = calloc(row_bytes, height);
+    GString *concat = g_string_new("ffconcat version 1.0\n");
+    char *name = NULL;
+    uint32_t shown_at = 0;
+    int count = 0;
+    bool ok = true;
+
+    while(true) {
+        uint32_t at;
+        uint16_t run_count;
+        if(!get_u32(f, &at) || !get_u16(f, &run_count)) {
+            break;
+        }
+
+        for(int i = 0; i < run_count && ok; i++) {
+            uint16_t first, rows;
+            ok = get_u16(f, &first) && get_u16(f, &rows)
+                && first + rows <= height
+                && fread(&frame[first * row_bytes], row_bytes, rows, f) == rows;
+        }
+        if(!ok) {
+            log(LEVEL_ERROR, "Recording is cut short: %s\n", path);
+            break;
+        }
+
+        // The frame before this one lasted until now
+        if(name) {
+            g_string_append_printf(concat, "file '%s'\nduration %.3f\n", name, (at - shown_at) / 1000.0);
+            g_free(name);
+            name = NULL;
+        }
+
+        if(run_count == 0) {
+            continue;
+        }
+
+        char *frame_path = g_strdup_printf("%s-%05d.png", prefix, count++);
+        ok = write_png(frame_path, &sc, row_bytes, frame);
+        name = g_path_get_basename(frame_path);
+        shown_at = at;
+        g_free(frame_path);
+        if(!ok) {
+            break;
+        }
+    }
+
+    if(name) {
+        g_string_append_printf(concat, "file '%s'\n", name);
+        g_free(name);
+    }
+
+    char *concat_path = g_strdup_printf("%s.ffconcat", prefix);
+    if(!g_file_set_contents(concat_path, concat->str, concat->len, NULL)) {
+        log(LEVEL_ERROR, "Could not write %s\n", concat_path);
+        ok = false;
+    }
+    g_free(concat_path);
+    g_string_free(concat, TRUE);
+
+    log(LEVEL_INFO, "Exported %d frames\n", count);
+
+    free(frame);
+    fclose(f);
+    return ok;
+}
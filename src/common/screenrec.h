@@ -0,0 +1,60 @@
+#ifndef __COMMON_SCREENREC_H__
+#define __COMMON_SCREENREC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "calc.h"
+
+#define SCREENREC_MAGIC "TISCREEN"
+#define SCREENREC_VERSION 1
+
+/**
+ * An append-only recording of the LCD. All numbers are little endian.
+ *
+ * Header:
+ *   char magic[8], uint8 version, uint8 pixel_format,
+ *   uint16 width, uint16 height, uint16 row_bytes
+ *
+ * Then a record per frame that changed:
+ *   uint32 ms since the first frame, uint16 run count
+ *   and for each run of changed rows:
+ *     uint16 first row, uint16 row count, row_count * row_bytes of pixels
+ *
+ * The first frame is one run covering the whole screen. Frames that match
+ * the one before aren't written. A record with no runs marks when the
+ * recording stopped, so the last frame has a duration.
+ */
+typedef struct {
+    FILE *file;
+    CalcScreenCoord sc;
+    unsigned int row_bytes;
+    uint8_t *last;
+    uint64_t started_at;
+    unsigned long frames;
+    unsigned long written;
+} ScreenRecorder;
+
+ScreenRecorder* screenrec_open(const char* path);
+
+/**
+ * Append a frame if anything changed since the last one.
+ */
+bool screenrec_add(ScreenRecorder* rec, const CalcScreenCoord* sc, const uint8_t* bitmap);
+
+void screenrec_close(ScreenRecorder* rec);
+
+/**
+ * Capture frames as fast as the link allows for duration_ms, or until a
+ * capture fails if it's 0.
+ */
+int screenrec_record(CalcSession* session, const char* path, uint64_t duration_ms);
+
+/**
+ * Write each frame of a recording as PREFIX-00000.png and so on, and
+ * PREFIX.ffconcat with their timing for ffmpeg to turn into a video or GIF.
+ */
+bool screenrec_export_png(const char* path, const char* prefix);
+
+#endif
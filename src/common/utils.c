@@ -1,10 +1,11 @@
 #include "utils.h"
 #include <string.h>
 #include <getopt.h>
+#include <time.h>
 
 LOG_LEVEL current_log_level = LEVEL_INFO;
 
-CableHandle* utils_setup_cable() {
+int utils_setup_cables(CableHandle** handles, int max) {
 	// search for all USB cables (faster)
 	log(LEVEL_INFO, "Searching for link cables...\n");
     int **cables = NULL;
@@ -12,30 +13,47 @@ CableHandle* utils_setup_cable() {
 	if(err) {
         log(LEVEL_ERROR, "Could not probe cable: %d\n", err);
 		ticables_probing_finish(&cables);
-		return NULL;
+		return 0;
 	}
 
-    CableModel model;
-    int port;
-    for(model = CABLE_NUL; model < CABLE_MAX ; model++) {
+    int count = 0;
+    for(CableModel model = CABLE_NUL; model < CABLE_MAX && count < max; model++) {
         int *ports = cables[model];
-        int i;
-        for(i = 0; !ports[i] && i < 5; i++);
+        for(int i = 0; i < 5 && count < max; i++) {
+            // The probe gives what it found on each port, the port is the index
+            if(!ports[i]) {
+                continue;
+            }
 
-        port = ports[i];
-        if(port) {
             log(LEVEL_DEBUG, "Cable Model: %d, Port: %d\n", model, i);
-            break;
+
+            CableHandle *handle = ticables_handle_new(model, (CablePort)i);
+            ticables_options_set_delay(handle, 1);
+            ticables_options_set_timeout(handle, 5);
+            handles[count++] = handle;
         }
     }
 
-    CableHandle *handle = ticables_handle_new(model, port);
-    ticables_options_set_delay(handle, 1);
-    ticables_options_set_timeout(handle, 5);
+    ticables_probing_finish(&cables);
+
+    return count;
+}
+
+CableHandle* utils_setup_cable() {
+    CableHandle *handle = NULL;
+    if(utils_setup_cables(&handle, 1) == 0) {
+        return NULL;
+    }
 
     return handle;
 }
 
+uint64_t utils_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void utils_parse_args(int argc, char *argv[]) {
     const struct option long_opts[] = {
         {"log-level", required_argument, 0, 'L'},
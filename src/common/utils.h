@@ -66,6 +66,13 @@ extern LOG_LEVEL current_log_level;
 
 CableHandle* utils_setup_cable();
 
+/**
+ * Handles for every cable found, up to max. Returns how many there are.
+ */
+int utils_setup_cables(CableHandle** handles, int max);
+
+uint64_t utils_now_ms(void);
+
 void utils_parse_args(int argc, char *argv[]);
 
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <tilp2/ticables.h>
+#include <tilp2/ticalcs.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -12,126 +13,50 @@
 #include <netinet/in.h>
 
 #include "common/utils.h"
-
-static CableHandle* cable_handle;
+#include "common/calc.h"
+#include "tibridge/link.h"
+#include "tibridge/watch.h"
+#include "tibridge/trace.h"
+#include "tibridge/profile.h"
+#include "tibridge/symbols.h"
+#include "tibridge/mirror.h"
+#include "tibridge/monitor.h"
+#include "tibridge/run.h"
 
 void show_help() {
     log(LEVEL_INFO, "Syntax: tibridge [--no-handle-acks|--handle-acks]\n");
     log(LEVEL_INFO,
+"--calc=83p:       The connected model, for monitor commands. Default: 83p\n"
+"                  Those only work while no stub is attached, before the\n"
+"                  program starts or after it exits. Until then the bridge\n"
+"                  answers GDB's connection itself; once a launched stub\n"
+"                  is up, flushregs shows its real state.\n"
 "--no-handle-acks: By default, ACKs (-/+) will be hidden from the client.\n"
 "                  This is necessary for working with z88dk-gdb. If you're\n"
-"                  using a better client, you can disable this."
+"                  using a better client, you can disable this.\n"
+"--profile=PREFIX: Sample the PC while the program runs and write\n"
+"                  PREFIX.flat and PREFIX.folded when it stops.\n"
+"--map=FILE:       z88dk map file used to name the samples.\n"
+"--profile-budget=10:\n"
+"                  Percent of time the target may spend stopped for sampling.\n"
+"--profile-stack=0:\n"
+"                  Stack words to read per sample for call chains.\n"
+"--run=PROGRAM:    Start PROGRAM on the open link and wait for its stub, so\n"
+"                  GDB can attach without tikeys handing the cable over.\n"
+"--subtype=noshell:\n"
+"                  How to start the --run program. Only noshell starts it\n"
+"                  by itself, so it's the only one allowed.\n"
+"--mirror=FILE:    Keep a copy of target memory in FILE for other programs to\n"
+"                  mmap. See src/tibridge/mirror.h for the layout.\n"
+"--mirror-range=8000-FFFF:\n"
+"                  Refresh this range on every stop, not only when a reader\n"
+"                  asks for it. Can be given more than once.\n"
     );
 }
 
-int hex(char ch) {
-    if ((ch >= 'a') && (ch <= 'f'))
-        return (ch - 'a' + 10);
-    if ((ch >= '0') && (ch <= '9'))
-        return (ch - '0');
-    if ((ch >= 'A') && (ch <= 'F'))
-        return (ch - 'A' + 10);
-    return (-1);
-}
-
-char *hex2mem(const char *buf, char *mem, uint32_t count) {
-    unsigned char ch;
-    for (int i = 0; i < count; i++)
-    {
-        ch = hex(*buf++) << 4;
-        ch = ch + hex(*buf++);
-        *(mem++) = (char)ch;
-    }
-    return (mem);
-}
-
-void reset_cable(void) {
-    CablePort port;
-    CableModel model;
-    port = cable_handle->port;
-    model = cable_handle->model;
-    int err;
-    ticables_cable_reset(cable_handle);
-    ticables_cable_close(cable_handle);
-    ticables_handle_del(cable_handle);
-    cable_handle = ticables_handle_new(model, port);
-    ticables_options_set_delay(cable_handle, 1);
-    ticables_options_set_timeout(cable_handle, 5);
-
-    while((err = ticables_cable_open(cable_handle))) {
-        log(LEVEL_ERROR, "Could not open cable: %d\n", err);
-    }
-}
-
-void retry_write_calc(uint8_t* send, int sendCount) {
-    unsigned char err = 0;
-    log(LEVEL_DEBUG, "%d->", sendCount);
-    log(LEVEL_TRACE, "%.*s\n", sendCount, send);
-    while((err = ticables_cable_send(cable_handle, send, sendCount))) {
-        log(LEVEL_ERROR, "Error sending: %d", err);
-        reset_cable();
-    }
-}
-
-void retry_read_calc(uint8_t* recv, int getCount) {
-    int err;
-    do {
-        if((err = ticables_cable_recv(cable_handle, recv, getCount))) {
-            log(LEVEL_ERROR, "error receiving: %d\n", err);
-        }
-    } while(err);
-    log(LEVEL_TRACE, "%.*s", getCount, recv);
-}
-
-void ack() {
-    retry_write_calc((uint8_t*)"+", 1);
-}
-
-void nack() {
-    retry_write_calc((uint8_t*)"-", 1);
-}
-
-int listenFd = -1;
-int connectionFd = -1;
-
-void retry_write_host(uint8_t* recv, int recvCount) {
-    if(connectionFd == -1) {
-        connectionFd = accept(listenFd, NULL, NULL);
-    }
-
-    log(LEVEL_DEBUG, "%d<-", recvCount);
-    log(LEVEL_TRACE, "%.*s\n", recvCount, recv)
-    int c = 0;
-    while(c < recvCount) {
-        int s = write(connectionFd, &recv[c], recvCount - c);
-        if(s <= 0) {
-            close(connectionFd);
-            connectionFd = accept(listenFd, NULL, NULL);
-            continue;
-        }
-        c += s;
-    }
-}
-
-void retry_read_host(void* buf, unsigned int count) {
-    if(connectionFd == -1) {
-        connectionFd = accept(listenFd, NULL, NULL);
-        log(LEVEL_DEBUG, "Accepted connection\n");
-    }
-
-    int c = 0;
-    while(c < count) {
-        int s = read(connectionFd, buf, count - c);
-        if(s <= 0) {
-            close(connectionFd);
-            connectionFd = accept(listenFd, NULL, NULL);
-            continue;
-        }
-        c += s;
-    }
-}
-
 void cleanup() {
+    mirror_close();
+    calc_session_close(&calc_session);
     if(cable_handle) {
         ticables_cable_close(cable_handle);
         ticables_handle_del(cable_handle);
@@ -177,9 +102,17 @@ int main(int argc, char *argv[]) {
     sa.sa_handler = handle_sigint;
     sigaction(SIGINT, &sa, NULL);
 
-    // z88dk-gdb doesn't like the ACKs -/+, so we just hide them
-    int handle_acks = 1;
     unsigned int port = 8998;
+    char *map_file = NULL;
+    char *mirror_file = NULL;
+    char *run_program = NULL;
+    char *run_subtype = "noshell";
+    CalcModel model = CALC_TI83P;
+    ProfileOptions profile_options = {
+        .prefix = NULL,
+        .budget = PROFILE_BUDGET_DEFAULT,
+        .stack_depth = 0,
+    };
 
     utils_parse_args(argc, argv);
 
@@ -188,6 +121,18 @@ int main(int argc, char *argv[]) {
         {"no-handle-acks", no_argument, &handle_acks, 0},
 
         {"port", required_argument, 0, 'p'},
+        {"calc", required_argument, 0, 'c'},
+
+        {"profile", required_argument, 0, 'P'},
+        {"map", required_argument, 0, 'M'},
+        {"profile-budget", required_argument, 0, 'B'},
+        {"profile-stack", required_argument, 0, 'S'},
+
+        {"run", required_argument, 0, 'r'},
+        {"subtype", required_argument, 0, 's'},
+
+        {"mirror", required_argument, 0, 'm'},
+        {"mirror-range", required_argument, 0, 'R'},
 
         {"help", no_argument, 0, 'h'},
         {0,0,0,0}
@@ -196,7 +141,7 @@ int main(int argc, char *argv[]) {
     optind = 0;
     int opt_index = 0;
     int opt;
-    while((opt = getopt_long(argc, argv, ":p:", long_opts, &opt_index)) != -1) {
+    while((opt = getopt_long(argc, argv, ":p:c:", long_opts, &opt_index)) != -1) {
         if(optarg != NULL && strncmp(optarg, "=", 1) == 0) {
             optarg = &optarg[1];
         }
@@ -212,12 +157,59 @@ int main(int argc, char *argv[]) {
         else if(opt == 'p') {
             sscanf(optarg, "%u", &port);
         }
+        else if(opt == 'c') {
+            model = ticalcs_string_to_model(optarg);
+            if(model == CALC_NONE) {
+                log(LEVEL_ERROR, "Invalid calculator model\n");
+                return 1;
+            }
+        }
+        else if(opt == 'P') {
+            profile_options.prefix = optarg;
+        }
+        else if(opt == 'M') {
+            map_file = optarg;
+        }
+        else if(opt == 'B') {
+            sscanf(optarg, "%u", &profile_options.budget);
+        }
+        else if(opt == 'S') {
+            sscanf(optarg, "%u", &profile_options.stack_depth);
+        }
+        else if(opt == 'r') {
+            run_program = optarg;
+        }
+        else if(opt == 's') {
+            run_subtype = optarg;
+        }
+        else if(opt == 'm') {
+            mirror_file = optarg;
+        }
+        else if(opt == 'R') {
+            unsigned int start, end;
+            if(sscanf(optarg, "%x-%x", &start, &end) != 2 || start > end || end > 0xffff) {
+                log(LEVEL_ERROR, "Invalid mirror range: %s\n", optarg);
+                show_help();
+                return 1;
+            }
+            mirror_add_range(start, end);
+        }
         else if(opt == 'h') {
             show_help();
             return 0;
         }
     }
 
+    if(mirror_file && !mirror_init(mirror_file)) {
+        return 1;
+    }
+
+    if(map_file && !symbols_load(map_file)) {
+        return 1;
+    }
+
+    profile_init(&profile_options);
+
     log(LEVEL_DEBUG, "handle acks: %d\n", handle_acks);
     log(LEVEL_DEBUG, "port: %d\n", port);
 
@@ -236,7 +228,8 @@ int main(int argc, char *argv[]) {
 
     ticables_options_set_timeout(cable_handle , 1 * 60 * 60 * 10);
 
-    err = ticables_cable_open(cable_handle);
+    // The calc handle opens the cable, and lets monitor commands share it
+    err = calc_session_open(&calc_session, model, cable_handle);
     if(err) {
         log(LEVEL_ERROR, "Could not open cable: %d\n", err);
         return 1;
@@ -252,21 +245,55 @@ int main(int argc, char *argv[]) {
     log(LEVEL_INFO, "Cable Family %d, Variant %d\n", info.family, info.variant);
 
     bool handled_first_recv = false;
+    bool skip_receive = false;
+    // Until a stub speaks, the OS owns the link and monitor commands can use it
+    bool stub_attached = false;
+    // GDB was told about a stopped target before there was one
+    bool answered_locally = false;
+
+    if(run_program) {
+        if(!run_start(run_subtype, run_program)) {
+            return 1;
+        }
+
+        // The stub's start up has been read, and it's waiting for a command
+        handled_first_recv = true;
+        skip_receive = true;
+        stub_attached = true;
+    }
 
     while(true) {
-        uint8_t recv[1023];
+        uint8_t recv[PACKET_MAX];
         int recvCount = 0;
 
         log(LEVEL_INFO, "<");
         log(LEVEL_DEBUG, "RECEIVE PHASE\n");
-        while(true) {
+        while(!skip_receive) {
             int getCount = 1;
             unsigned char *current = NULL;
             if(recvCount > 0 && memchr(recv, '$', recvCount)) {
                 getCount = 3;
             }
 
-            retry_read_calc(&recv[recvCount], getCount);
+            if(recvCount == 0) {
+                // Nothing from the stub yet. Without one, GDB's connection is
+                // answered here so it can get as far as monitor commands.
+                while(!read_calc_idle(recv)) {
+                    uint8_t send[PACKET_MAX + 1];
+                    int sendCount = read_host_packet(send, sizeof(send));
+                    if(monitor_handle_packet(send, sendCount, !stub_attached)) {
+                        continue;
+                    }
+                    if(!stub_attached && monitor_handle_detached(send, sendCount)) {
+                        answered_locally = true;
+                        continue;
+                    }
+                    unread_host_packet(send, sendCount);
+                }
+            }
+            else {
+                retry_read_calc(&recv[recvCount], getCount);
+            }
             recvCount += getCount;
             if((current = memchr(&recv[recvCount-getCount], '#', getCount))) {
                 getCount = 2 - ((&recv[recvCount]) - current - 1);
@@ -277,6 +304,17 @@ int main(int argc, char *argv[]) {
 
                 recv[recvCount] = '\0';
 
+                stub_attached = true;
+                if(answered_locally && !strstr((const char*)recv, "$O")) {
+                    // GDB already has a stop from us, so this one would be
+                    // a reply to nothing. Console output still goes through.
+                    log(LEVEL_DEBUG, "Discarded the stub's first packet\n");
+                    handled_first_recv = true;
+                    ack();
+                    recvCount = 0;
+                    continue;
+                }
+
                 if(!handle_acks || handled_first_recv) {
                     retry_write_host(recv, recvCount);
                 }
@@ -296,6 +334,11 @@ int main(int argc, char *argv[]) {
                         recvCount = 0;
                         continue;
                     }
+
+                    if(*packet_char == 'W' || *packet_char == 'X') {
+                        // The program is gone, and the OS has the link again
+                        stub_attached = false;
+                    }
                 }
 
                 if(handle_acks) {
@@ -312,12 +355,13 @@ int main(int argc, char *argv[]) {
             else if(recvCount == 1) {
                 current = &recv[recvCount - 1];
                 if(*current == '-') {
-                    if(!handle_acks) {
+                    if(!handle_acks && !answered_locally) {
                         retry_write_host(recv, recvCount);
                     }
                     else {
                         log(LEVEL_DEBUG, "Discarding a NACK\n");
                     }
+                    answered_locally = false;
                     recvCount = 0;
                     break;
                 }
@@ -327,6 +371,8 @@ int main(int argc, char *argv[]) {
             }
         }
 
+        skip_receive = false;
+
         fd_set set;
         FD_ZERO(&set);
         FD_SET(0, &set);
@@ -334,22 +380,27 @@ int main(int argc, char *argv[]) {
         log(LEVEL_INFO, ">");
         log(LEVEL_DEBUG, "SEND PHASE\n");
         while(true) {
-            uint8_t current;
-            uint8_t send[255];
-            int sendCount = 0;
-
-            while(true) {
-                retry_read_host(&send[sendCount], 1);
-                current = send[sendCount];
-                sendCount++;
-                if(current == '#') {
-                    retry_read_host(&send[sendCount], 2);
-                    sendCount += 2;
-                    break;
-                }
-                else if(sendCount == 1 && (current == '-' || current == '+')) {
-                    break;
-                }
+            uint8_t send[PACKET_MAX + 1];
+
+            mirror_refresh();
+
+            // Readers may ask for pages while GDB sits at the stop
+            while(mirror_active() && !host_wait(MIRROR_POLL_MS)) {
+                mirror_refresh();
+            }
+
+            int sendCount = read_host_packet(send, sizeof(send));
+
+            mirror_observe_packet(send, sendCount);
+
+            if(
+                monitor_handle_packet(send, sendCount, false)
+                || run_handle_packet(send, sendCount)
+                || watch_handle_packet(send, sendCount)
+                || trace_handle_packet(send, sendCount)
+                || profile_handle_packet(send, sendCount)
+            ) {
+                continue;
             }
 
             retry_write_calc(send, sendCount);
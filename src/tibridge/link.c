@@ -0,0 +1,453 @@
+#include "link.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+
+#include "../common/utils.h"
+
+CableHandle* cable_handle = NULL;
+CalcSession calc_session = { 0 };
+
+// z88dk-gdb doesn't like the ACKs -/+, so we just hide them
+int handle_acks = 1;
+
+int listenFd = -1;
+int connectionFd = -1;
+
+// ACKs GDB still owes us for packets we sent it ourselves
+static int swallow_host_acks = 0;
+
+// A packet GDB sent while we were waiting on the calculator
+static uint8_t pending_host[PACKET_MAX + 1];
+static int pending_host_count = 0;
+
+int hex(char ch) {
+    if ((ch >= 'a') && (ch <= 'f'))
+        return (ch - 'a' + 10);
+    if ((ch >= '0') && (ch <= '9'))
+        return (ch - '0');
+    if ((ch >= 'A') && (ch <= 'F'))
+        return (ch - 'A' + 10);
+    return (-1);
+}
+
+char *hex2mem(const char *buf, char *mem, uint32_t count) {
+    unsigned char ch;
+    for (int i = 0; i < count; i++)
+    {
+        ch = hex(*buf++) << 4;
+        ch = ch + hex(*buf++);
+        *(mem++) = (char)ch;
+    }
+    return (mem);
+}
+
+char *mem2hex(const char *mem, char *buf, uint32_t count) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < count; i++)
+    {
+        unsigned char ch = *mem++;
+        *(buf++) = digits[ch >> 4];
+        *(buf++) = digits[ch & 0xf];
+    }
+    *buf = '\0';
+    return (buf);
+}
+
+void reset_cable(void) {
+    CablePort port;
+    CableModel model;
+    port = cable_handle->port;
+    model = cable_handle->model;
+    int err;
+    ticables_cable_reset(cable_handle);
+    if(calc_session.calc) {
+        ticalcs_cable_detach(calc_session.calc);
+    }
+    ticables_cable_close(cable_handle);
+    ticables_handle_del(cable_handle);
+    cable_handle = ticables_handle_new(model, port);
+    ticables_options_set_delay(cable_handle, 1);
+    ticables_options_set_timeout(cable_handle, 5);
+
+    if(calc_session.calc) {
+        calc_session.cable = cable_handle;
+        while((err = ticalcs_cable_attach(calc_session.calc, cable_handle))) {
+            log(LEVEL_ERROR, "Could not open cable: %d\n", err);
+        }
+        return;
+    }
+
+    while((err = ticables_cable_open(cable_handle))) {
+        log(LEVEL_ERROR, "Could not open cable: %d\n", err);
+    }
+}
+
+void retry_write_calc(uint8_t* send, int sendCount) {
+    unsigned char err = 0;
+    log(LEVEL_DEBUG, "%d->", sendCount);
+    log(LEVEL_TRACE, "%.*s\n", sendCount, send);
+    while((err = ticables_cable_send(cable_handle, send, sendCount))) {
+        log(LEVEL_ERROR, "Error sending: %d", err);
+        reset_cable();
+    }
+}
+
+void retry_read_calc(uint8_t* recv, int getCount) {
+    int err;
+    do {
+        if((err = ticables_cable_recv(cable_handle, recv, getCount))) {
+            log(LEVEL_ERROR, "error receiving: %d\n", err);
+        }
+    } while(err);
+    log(LEVEL_TRACE, "%.*s", getCount, recv);
+}
+
+void ack() {
+    retry_write_calc((uint8_t*)"+", 1);
+}
+
+void nack() {
+    retry_write_calc((uint8_t*)"-", 1);
+}
+
+void retry_write_host(uint8_t* recv, int recvCount) {
+    if(connectionFd == -1) {
+        connectionFd = accept(listenFd, NULL, NULL);
+    }
+
+    log(LEVEL_DEBUG, "%d<-", recvCount);
+    log(LEVEL_TRACE, "%.*s\n", recvCount, recv)
+    int c = 0;
+    while(c < recvCount) {
+        int s = write(connectionFd, &recv[c], recvCount - c);
+        if(s <= 0) {
+            close(connectionFd);
+            connectionFd = accept(listenFd, NULL, NULL);
+            continue;
+        }
+        c += s;
+    }
+}
+
+void retry_read_host(void* buf, unsigned int count) {
+    if(connectionFd == -1) {
+        connectionFd = accept(listenFd, NULL, NULL);
+        log(LEVEL_DEBUG, "Accepted connection\n");
+    }
+
+    int c = 0;
+    while(c < count) {
+        int s = read(connectionFd, buf, count - c);
+        if(s <= 0) {
+            close(connectionFd);
+            connectionFd = accept(listenFd, NULL, NULL);
+            continue;
+        }
+        c += s;
+    }
+}
+
+int packet_payload(const uint8_t* packet, int count, char* payload, int size) {
+    const uint8_t *start = memchr(packet, '$', count);
+    if(start == NULL) {
+        return -1;
+    }
+    start++;
+
+    const uint8_t *end = memchr(start, '#', count - (start - packet));
+    if(end == NULL || end - start >= size) {
+        return -1;
+    }
+
+    int len = end - start;
+    memcpy(payload, start, len);
+    payload[len] = '\0';
+    return len;
+}
+
+void unread_host_packet(const uint8_t* send, int sendCount) {
+    memcpy(pending_host, send, sendCount);
+    pending_host_count = sendCount;
+}
+
+int read_host_packet(uint8_t* send, int size) {
+    uint8_t current;
+    int sendCount = 0;
+
+    if(pending_host_count > 0 && pending_host_count < size) {
+        sendCount = pending_host_count;
+        pending_host_count = 0;
+        memcpy(send, pending_host, sendCount);
+        send[sendCount] = '\0';
+        return sendCount;
+    }
+
+    while(true) {
+        retry_read_host(&send[sendCount], 1);
+        current = send[sendCount];
+        sendCount++;
+        if(current == '#') {
+            retry_read_host(&send[sendCount], 2);
+            sendCount += 2;
+            break;
+        }
+        else if(sendCount == 1 && (current == '-' || current == '+')) {
+            if(current == '+' && swallow_host_acks > 0) {
+                swallow_host_acks--;
+                sendCount = 0;
+                continue;
+            }
+            break;
+        }
+        else if(sendCount >= size - 2) {
+            log(LEVEL_ERROR, "Packet from host is too long, dropping it\n");
+            sendCount = 0;
+        }
+    }
+
+    send[sendCount] = '\0';
+    return sendCount;
+}
+
+bool host_wait(int timeout_ms) {
+    if(pending_host_count > 0) {
+        return true;
+    }
+
+    // Before GDB connects, a connection waiting counts
+    struct pollfd pfd = { .fd = connectionFd != -1 ? connectionFd : listenFd, .events = POLLIN };
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+bool host_interrupted(void) {
+    if(connectionFd == -1) {
+        return false;
+    }
+
+    struct pollfd pfd = { .fd = connectionFd, .events = POLLIN };
+    if(poll(&pfd, 1, 0) <= 0) {
+        return false;
+    }
+
+    uint8_t ch;
+    if(recv(connectionFd, &ch, 1, MSG_PEEK) != 1 || ch != 0x03) {
+        return false;
+    }
+
+    retry_read_host(&ch, 1);
+    return true;
+}
+
+static bool host_readable(void) {
+    if(connectionFd == -1) {
+        struct pollfd pfd = { .fd = listenFd, .events = POLLIN };
+        if(poll(&pfd, 1, 0) <= 0) {
+            return false;
+        }
+        connectionFd = accept(listenFd, NULL, NULL);
+        log(LEVEL_DEBUG, "Accepted connection\n");
+    }
+
+    struct pollfd pfd = { .fd = connectionFd, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+bool read_calc_idle(uint8_t* recv) {
+    bool got = false;
+    int timeout = cable_handle->timeout;
+    ticables_options_set_timeout(cable_handle, 1);
+    while(true) {
+        if(!ticables_cable_recv(cable_handle, recv, 1)) {
+            got = true;
+            log(LEVEL_TRACE, "%.*s", 1, recv);
+            break;
+        }
+
+        if(pending_host_count == 0 && host_readable()) {
+            if(host_interrupted()) {
+                log(LEVEL_DEBUG, "Passing a break to the target\n");
+                retry_write_calc((uint8_t*)"\x03", 1);
+                ticables_options_set_timeout(cable_handle, 1);
+                continue;
+            }
+            break;
+        }
+    }
+    ticables_options_set_timeout(cable_handle, timeout);
+    return got;
+}
+
+static int write_packet(uint8_t* buf, const char* payload) {
+    uint8_t checksum = 0;
+    int len = strlen(payload);
+    buf[0] = '$';
+    for(int i = 0; i < len; i++) {
+        buf[i + 1] = payload[i];
+        checksum += (uint8_t)payload[i];
+    }
+    sprintf((char*)&buf[len + 1], "#%02x", checksum);
+    return len + 4;
+}
+
+void reply_host(const char* payload) {
+    uint8_t buf[PACKET_MAX + 1];
+    if(!handle_acks) {
+        retry_write_host((uint8_t*)"+", 1);
+        swallow_host_acks++;
+    }
+    retry_write_host(buf, write_packet(buf, payload));
+}
+
+// Wait for the first byte of a unit. While the target is running the wait is
+// split into short reads so that we can send it a break in between.
+static void wait_calc_byte(uint8_t* recv, ResumeState* state) {
+    if(state == NULL) {
+        retry_read_calc(recv, 1);
+        return;
+    }
+
+    int timeout = cable_handle->timeout;
+    ticables_options_set_timeout(cable_handle, 1);
+    while(ticables_cable_recv(cable_handle, recv, 1)) {
+        if(state->interrupted) {
+            continue;
+        }
+
+        if(host_interrupted()) {
+            state->host_interrupted = true;
+        }
+        else if(!state->interrupt_at || utils_now_ms() < state->interrupt_at) {
+            continue;
+        }
+
+        log(LEVEL_DEBUG, "Interrupting the target\n");
+        state->interrupted = true;
+        state->interrupted_at = utils_now_ms();
+        retry_write_calc((uint8_t*)"\x03", 1);
+        ticables_options_set_timeout(cable_handle, 1);
+    }
+    ticables_options_set_timeout(cable_handle, timeout);
+    log(LEVEL_TRACE, "%.*s", 1, recv);
+}
+
+static int read_unit(uint8_t* recv, int size, ResumeState* state) {
+    int recvCount = 0;
+
+    // Skip noise until we see the start of something we understand
+    do {
+        wait_calc_byte(recv, state);
+    } while(recv[0] != '$' && recv[0] != '+' && recv[0] != '-');
+
+    recvCount = 1;
+    if(recv[0] != '$') {
+        return recvCount;
+    }
+
+    while(true) {
+        int getCount = 3;
+        uint8_t *current = NULL;
+        if(recvCount + getCount >= size) {
+            log(LEVEL_ERROR, "Packet from calc is too long\n");
+            return -1;
+        }
+
+        retry_read_calc(&recv[recvCount], getCount);
+        recvCount += getCount;
+        if((current = memchr(&recv[recvCount-getCount], '#', getCount))) {
+            getCount = 2 - ((&recv[recvCount]) - current - 1);
+            if(getCount > 0) {
+                retry_read_calc(&recv[recvCount], getCount);
+                recvCount += getCount;
+            }
+
+            recv[recvCount] = '\0';
+            return recvCount;
+        }
+    }
+}
+
+static bool is_console_output(const char *payload, int len) {
+    if(len < 3 || payload[0] != 'O' || (len - 1) % 2) {
+        return false;
+    }
+    for(int i = 1; i < len; i++) {
+        if(hex(payload[i]) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int read_calc_unit(uint8_t* recv, int size) {
+    return read_unit(recv, size, NULL);
+}
+
+static int transact(const char* cmd, char* reply, int size, ResumeState* state) {
+    uint8_t buf[PACKET_MAX + 1];
+    int replyCount = -1;
+    int attempts = 0;
+
+    log(LEVEL_DEBUG, "Bridge command: %s\n", cmd);
+    retry_write_calc(buf, write_packet(buf, cmd));
+
+    while(true) {
+        int recvCount = read_unit(buf, sizeof(buf), state);
+        if(recvCount < 0) {
+            nack();
+            continue;
+        }
+
+        if(recvCount == 1) {
+            if(buf[0] != '-') {
+                continue;
+            }
+            if(handle_acks && replyCount >= 0) {
+                // The stub is ready for the next command
+                return replyCount;
+            }
+            if(++attempts > 3) {
+                log(LEVEL_ERROR, "Stub refused command: %s\n", cmd);
+                return -1;
+            }
+            retry_write_calc(buf, write_packet(buf, cmd));
+            continue;
+        }
+
+        char *payload = (char*)&buf[1];
+        int len = recvCount - 4;
+
+        ack();
+
+        if(is_console_output(payload, len)) {
+            int data_size = (len - 1) / 2;
+            char out[data_size];
+            hex2mem(&payload[1], out, data_size);
+            log(LEVEL_INFO, "\n%.*s", data_size, out);
+            continue;
+        }
+
+        replyCount = len < size ? len : size - 1;
+        memcpy(reply, payload, replyCount);
+        reply[replyCount] = '\0';
+
+        if(!handle_acks) {
+            return replyCount;
+        }
+    }
+}
+
+int calc_command(const char* cmd, char* reply, int size) {
+    return transact(cmd, reply, size, NULL);
+}
+
+int calc_resume(const char* cmd, char* reply, int size, ResumeState* state) {
+    state->interrupted = false;
+    state->host_interrupted = false;
+    return transact(cmd, reply, size, state);
+}
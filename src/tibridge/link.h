@@ -0,0 +1,102 @@
+#ifndef __TIBRIDGE_LINK_H__
+#define __TIBRIDGE_LINK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <tilp2/ticables.h>
+
+#include "../common/calc.h"
+
+// Largest packet (including $ and #xx) that we will buffer from either side
+#define PACKET_MAX 1023
+
+extern CableHandle* cable_handle;
+// Shares cable_handle, for the things that need ticalcs
+extern CalcSession calc_session;
+extern int handle_acks;
+extern int listenFd;
+extern int connectionFd;
+
+int hex(char ch);
+char *hex2mem(const char *buf, char *mem, uint32_t count);
+char *mem2hex(const char *mem, char *buf, uint32_t count);
+
+void reset_cable(void);
+void retry_write_calc(uint8_t* send, int sendCount);
+void retry_read_calc(uint8_t* recv, int getCount);
+void ack();
+void nack();
+
+void retry_write_host(uint8_t* recv, int recvCount);
+void retry_read_host(void* buf, unsigned int count);
+
+/**
+ * Copy the payload between $ and #xx out of a packet. Returns -1 if the
+ * buffer holds an ACK/NACK or anything else that isn't a packet.
+ */
+int packet_payload(const uint8_t* packet, int count, char* payload, int size);
+
+/**
+ * Read one packet from GDB, or a lone ACK/NACK. ACKs for packets we answered
+ * ourselves are swallowed here so they never reach the calculator.
+ */
+int read_host_packet(uint8_t* send, int size);
+
+/**
+ * Hand a packet back so the next read_host_packet returns it.
+ */
+void unread_host_packet(const uint8_t* send, int sendCount);
+
+/**
+ * Wait up to timeout_ms for something from GDB. Returns true if
+ * read_host_packet has something to read.
+ */
+bool host_wait(int timeout_ms);
+
+/**
+ * Check without blocking whether GDB sent a break (Ctrl-C). The byte is
+ * consumed if it was a break.
+ */
+bool host_interrupted(void);
+
+/**
+ * Answer a GDB packet from the bridge instead of the calculator.
+ */
+void reply_host(const char* payload);
+
+/**
+ * Wait for a byte from the calculator, but give up if GDB sends a packet
+ * first so the caller can look at it. A break from GDB is passed straight
+ * on to the target. Returns true if recv holds a byte.
+ */
+bool read_calc_idle(uint8_t* recv);
+
+/**
+ * Read one unit from the calculator: either a lone +/- or a $...#xx packet.
+ */
+int read_calc_unit(uint8_t* recv, int size);
+
+/**
+ * Send a command to the stub and wait for its reply, the same way the relay
+ * loop would. Console output packets are printed and skipped. Returns the
+ * length of the reply payload (without $ and #xx), or -1 on failure.
+ */
+int calc_command(const char* cmd, char* reply, int size);
+
+typedef struct {
+    // Send a break to the stub once utils_now_ms() reaches this, 0 for never
+    uint64_t interrupt_at;
+    // Whether we sent a break, and whether it was GDB that asked for it
+    bool interrupted;
+    bool host_interrupted;
+    // When the break was sent
+    uint64_t interrupted_at;
+} ResumeState;
+
+/**
+ * Like calc_command, but for c/s where the target runs until it stops. A break
+ * from GDB is passed on to the stub while we wait for the stop reply.
+ */
+int calc_resume(const char* cmd, char* reply, int size, ResumeState* state);
+
+#endif
@@ -0,0 +1,177 @@
+#include "mirror.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "link.h"
+#include "target.h"
+#include "../common/utils.h"
+
+#define MIRROR_FILE_SIZE (MIRROR_DATA_OFFSET + 0x10000)
+
+static int mirror_fd = -1;
+static uint8_t *mirror_map = NULL;
+static MirrorHeader *header = NULL;
+static uint8_t *data = NULL;
+
+static uint8_t always[MIRROR_PAGES / 8];
+// Set when the target ran since the last refresh
+static bool stale = true;
+
+#define BIT_GET(bits, i) ((bits)[(i) / 8] & (1 << ((i) % 8)))
+#define BIT_SET(bits, i) ((bits)[(i) / 8] |= (1 << ((i) % 8)))
+#define BIT_CLEAR(bits, i) ((bits)[(i) / 8] &= ~(1 << ((i) % 8)))
+
+static void begin_update(void) {
+    header->generation++;
+    __sync_synchronize();
+}
+
+static void end_update(void) {
+    __sync_synchronize();
+    header->generation++;
+}
+
+bool mirror_init(const char* path) {
+    mirror_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(mirror_fd == -1) {
+        log(LEVEL_ERROR, "Could not open mirror file: %s\n", path);
+        return false;
+    }
+
+    if(ftruncate(mirror_fd, MIRROR_FILE_SIZE)) {
+        log(LEVEL_ERROR, "Could not size mirror file: %s\n", path);
+        mirror_close();
+        return false;
+    }
+
+    mirror_map = mmap(NULL, MIRROR_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mirror_fd, 0);
+    if(mirror_map == MAP_FAILED) {
+        log(LEVEL_ERROR, "Could not map mirror file: %s\n", path);
+        mirror_map = NULL;
+        mirror_close();
+        return false;
+    }
+
+    header = (MirrorHeader*)mirror_map;
+    data = &mirror_map[MIRROR_DATA_OFFSET];
+
+    // Keep the generation going up across restarts so readers notice
+    uint32_t generation = memcmp(header->magic, MIRROR_MAGIC, 8) == 0 ? header->generation : 0;
+    memset(mirror_map, 0, MIRROR_DATA_OFFSET);
+    memcpy(header->magic, MIRROR_MAGIC, 8);
+    header->version = MIRROR_VERSION;
+    header->page_size = MIRROR_PAGE_SIZE;
+    header->page_count = MIRROR_PAGES;
+    header->data_offset = MIRROR_DATA_OFFSET;
+    header->generation = generation + (generation & 1);
+
+    log(LEVEL_INFO, "Mirroring target memory to %s\n", path);
+
+    return true;
+}
+
+void mirror_add_range(uint16_t start, uint16_t end) {
+    for(int page = start / MIRROR_PAGE_SIZE; page <= end / MIRROR_PAGE_SIZE; page++) {
+        BIT_SET(always, page);
+    }
+}
+
+void mirror_invalidate(void) {
+    if(header == NULL || stale) {
+        return;
+    }
+
+    begin_update();
+    memset((uint8_t*)header->valid, 0, sizeof(header->valid));
+    end_update();
+    stale = true;
+}
+
+void mirror_observe_packet(const uint8_t* send, int sendCount) {
+    char payload[PACKET_MAX + 1];
+    if(header == NULL || packet_payload(send, sendCount, payload, sizeof(payload)) <= 0) {
+        return;
+    }
+
+    switch(payload[0]) {
+        case 'c':
+        case 'C':
+        case 's':
+        case 'S':
+        case 'v':
+        case 'R':
+        case 'k':
+            if(payload[0] != 'v' || strncmp(payload, "vCont;", 6) == 0) {
+                mirror_invalidate();
+            }
+            break;
+        case 'M':
+        case 'X': {
+            // The stub may refuse the write or only do part of it, so read
+            // the pages back rather than trusting what GDB sent
+            unsigned int addr, len;
+            if(sscanf(&payload[1], "%x,%x", &addr, &len) != 2) {
+                break;
+            }
+
+            begin_update();
+            for(unsigned int page = addr / MIRROR_PAGE_SIZE; page < MIRROR_PAGES && page * MIRROR_PAGE_SIZE < addr + len; page++) {
+                BIT_CLEAR(header->valid, page);
+            }
+            end_update();
+            break;
+        }
+    }
+}
+
+void mirror_refresh(void) {
+    if(header == NULL) {
+        return;
+    }
+
+    stale = false;
+
+    int refreshed = 0;
+    for(int page = 0; page < MIRROR_PAGES; page++) {
+        if(BIT_GET(header->valid, page) || !(BIT_GET(always, page) || BIT_GET(header->requested, page))) {
+            continue;
+        }
+
+        uint8_t buf[MIRROR_PAGE_SIZE];
+        if(!target_read_memory(page * MIRROR_PAGE_SIZE, buf, MIRROR_PAGE_SIZE)) {
+            continue;
+        }
+
+        begin_update();
+        memcpy(&data[page * MIRROR_PAGE_SIZE], buf, MIRROR_PAGE_SIZE);
+        BIT_SET(header->valid, page);
+        BIT_CLEAR(header->requested, page);
+        end_update();
+        refreshed++;
+    }
+
+    if(refreshed) {
+        log(LEVEL_DEBUG, "Refreshed %d mirror pages\n", refreshed);
+    }
+}
+
+bool mirror_active(void) {
+    return header != NULL;
+}
+
+void mirror_close(void) {
+    if(mirror_map) {
+        munmap(mirror_map, MIRROR_FILE_SIZE);
+        mirror_map = NULL;
+        header = NULL;
+        data = NULL;
+    }
+    if(mirror_fd != -1) {
+        close(mirror_fd);
+        mirror_fd = -1;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef __TIBRIDGE_MIRROR_H__
+#define __TIBRIDGE_MIRROR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MIRROR_MAGIC "TIMIRROR"
+#define MIRROR_VERSION 1
+#define MIRROR_PAGE_SIZE 256
+#define MIRROR_PAGES (0x10000 / MIRROR_PAGE_SIZE)
+// The memory starts on its own page so readers can mmap it directly
+#define MIRROR_DATA_OFFSET 4096
+// How often requested pages are looked for while GDB is idle at a stop
+#define MIRROR_POLL_MS 50
+
+/**
+ * Layout of the start of the mirror file. The target's 64K address space
+ * follows at MIRROR_DATA_OFFSET.
+ *
+ * generation is odd while the bridge is changing the file. Readers should
+ * read it, copy what they need, check the valid bits, and read it again; if
+ * it changed or was odd, try again. Setting a bit in requested asks the
+ * bridge to read that page. While the target is stopped that happens within
+ * MIRROR_POLL_MS, otherwise at the next stop.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t page_count;
+    uint32_t data_offset;
+    volatile uint32_t generation;
+    volatile uint8_t valid[MIRROR_PAGES / 8];
+    volatile uint8_t requested[MIRROR_PAGES / 8];
+} MirrorHeader;
+
+bool mirror_init(const char* path);
+
+/**
+ * Always refresh these pages on a stop, whether a reader asked or not.
+ */
+void mirror_add_range(uint16_t start, uint16_t end);
+
+/**
+ * Watch packets from GDB for anything that resumes the target or writes its
+ * memory. Never answers the packet.
+ */
+void mirror_observe_packet(const uint8_t* send, int sendCount);
+
+/**
+ * Mark every page stale, for when the target's memory changed in a way the
+ * GDB packets don't show, such as key presses or launching a program.
+ */
+void mirror_invalidate(void);
+
+/**
+ * Read the pages that are wanted and stale. Call when the target is stopped
+ * and the stub is waiting for a command.
+ */
+void mirror_refresh(void);
+
+/**
+ * Whether there's a mirror to keep up to date.
+ */
+bool mirror_active(void);
+
+void mirror_close(void);
+
+#endif
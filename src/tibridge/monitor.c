@@ -0,0 +1,262 @@
+#include "monitor.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "link.h"
+#include "mirror.h"
+#include "target.h"
+#include "../common/utils.h"
+#include "../common/calc.h"
+#include "../common/launch.h"
+#include "../common/dirlist.h"
+#include "../common/screen.h"
+#include "../common/keymacro.h"
+
+// Bytes of text per O packet, 2 hex characters each
+#define MONITOR_OUTPUT_MAX 256
+// Longest text a single monitor_printf can produce, over several O packets
+#define MONITOR_TEXT_MAX 1024
+
+static void monitor_printf(const char* fmt, ...) {
+    char text[MONITOR_TEXT_MAX];
+    char packet[MONITOR_OUTPUT_MAX * 2 + 2];
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    if(len >= sizeof(text)) {
+        len = sizeof(text) - 1;
+    }
+
+    // One O packet per line, and lines too long for a packet are split
+    for(int start = 0; start < len;) {
+        int count = len - start;
+        char *newline = memchr(&text[start], '\n', count);
+        if(newline) {
+            count = newline - &text[start] + 1;
+        }
+        if(count > MONITOR_OUTPUT_MAX) {
+            count = MONITOR_OUTPUT_MAX;
+        }
+
+        packet[0] = 'O';
+        mem2hex(&text[start], &packet[1], count);
+        reply_host(packet);
+        start += count;
+    }
+}
+
+static bool monitor_keys(char* args) {
+    if(!args || !*args) {
+        monitor_printf("Usage: monitor keys TEXT\n");
+        return false;
+    }
+
+    calc_send_ascii(&calc_session, args);
+    mirror_invalidate();
+    return true;
+}
+
+static bool monitor_macro(char* args) {
+    if(!args || !*args) {
+        monitor_printf("Usage: monitor macro SCRIPT\n");
+        return false;
+    }
+
+    int err = keymacro_play(&calc_session, args);
+    mirror_invalidate();
+    if(err) {
+        monitor_printf("Key macro failed: %d\n", err);
+        return false;
+    }
+
+    return true;
+}
+
+static bool monitor_launch(char* args) {
+    char *first = args ? strtok(args, " ") : NULL;
+    char *second = first ? strtok(NULL, " ") : NULL;
+    if(!first) {
+        monitor_printf("Usage: monitor launch [SUBTYPE] PROGRAM\n");
+        return false;
+    }
+
+    const char *subtype = second ? first : "noshell";
+    const char *program = second ? second : first;
+
+    // Whatever ran since the last launch may have changed the variables
+    dirlist_invalidate(&calc_session);
+    mirror_invalidate();
+    if(launch_program(&calc_session, subtype, program, false)) {
+        monitor_printf("Could not launch %s\n", program);
+        return false;
+    }
+
+    return true;
+}
+
+static bool monitor_screenshot(char* args) {
+    if(!args || !*args) {
+        monitor_printf("Usage: monitor screenshot FILE\n");
+        return false;
+    }
+
+    CalcScreenCoord sc;
+    uint8_t *bitmap = NULL;
+    if(screen_capture(&calc_session, &sc, &bitmap)) {
+        monitor_printf("Could not capture the screen\n");
+        return false;
+    }
+
+    bool ok = screen_write_pnm(args, &sc, bitmap);
+    ticalcs_free_screen(bitmap);
+    if(ok) {
+        monitor_printf("Wrote %ux%u screenshot to %s\n", sc.width, sc.height, args);
+    }
+
+    return ok;
+}
+
+static bool monitor_help(char* args) {
+    monitor_printf(
+        "monitor keys TEXT                  press alphanumeric keys\n"
+        "monitor macro SCRIPT               run a key macro, such as QUIT CLEAR PRGM\n"
+        "monitor launch [SUBTYPE] PROGRAM   start a program, with noshell by default\n"
+        "monitor screenshot FILE            save the LCD as PBM/PPM\n"
+        "All but help need the link, so only work while no program's stub is\n"
+        "attached: before it's launched, or after it has exited.\n"
+    );
+    return true;
+}
+
+static const struct {
+    const char *name;
+    bool (*func)(char* args);
+    // Talks to the OS over the link, so not while the stub has it
+    bool uses_link;
+} commands[] = {
+    {"keys", monitor_keys, true},
+    {"macro", monitor_macro, true},
+    {"launch", monitor_launch, true},
+    {"screenshot", monitor_screenshot, true},
+    {"help", monitor_help, false},
+};
+
+bool monitor_handle_packet(const uint8_t* send, int sendCount, bool link_free) {
+    char payload[PACKET_MAX + 1];
+    int len = packet_payload(send, sendCount, payload, sizeof(payload));
+    if(len <= 0 || strncmp(payload, "qRcmd,", 6) != 0) {
+        return false;
+    }
+
+    char line[PACKET_MAX / 2 + 1];
+    int line_len = (len - 6) / 2;
+    hex2mem(&payload[6], line, line_len);
+    line[line_len] = '\0';
+
+    char *args = strchr(line, ' ');
+    if(args) {
+        *args++ = '\0';
+        while(*args == ' ') {
+            args++;
+        }
+    }
+
+    log(LEVEL_DEBUG, "Monitor command: %s\n", line);
+
+    for(int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if(strcmp(commands[i].name, line) != 0) {
+            continue;
+        }
+
+        if(!commands[i].uses_link) {
+            reply_host(commands[i].func(args) ? "OK" : "E01");
+            return true;
+        }
+
+        if(calc_session.calc == NULL) {
+            monitor_printf("monitor %s needs a calculator model, see --calc\n", line);
+            reply_host("E01");
+            return true;
+        }
+
+        if(!link_free) {
+            // The stub owns the link, and OS packets would corrupt its stream
+            monitor_printf("monitor %s needs the link, which the program's stub has. "
+                "Use it before the program is launched or after it exits.\n", line);
+            reply_host("E01");
+            return true;
+        }
+
+        // The bridge waits for the stub forever, but key presses shouldn't
+        int timeout = cable_handle->timeout;
+        ticables_options_set_timeout(cable_handle, CABLE_TIMEOUT);
+        bool ok = commands[i].func(args);
+        ticables_options_set_timeout(cable_handle, timeout);
+
+        reply_host(ok ? "OK" : "E01");
+        return true;
+    }
+
+    // Let the stub have a go at anything we don't know
+    return false;
+}
+
+bool monitor_handle_detached(const uint8_t* send, int sendCount) {
+    if(sendCount == 1) {
+        // Acks for our own replies, with nobody else to pass them to
+        return send[0] == '+' || send[0] == '-';
+    }
+
+    char payload[PACKET_MAX + 1];
+    int len = packet_payload(send, sendCount, payload, sizeof(payload));
+    if(len <= 0) {
+        return false;
+    }
+
+    switch(payload[0]) {
+    case '?':
+        reply_host("S05");
+        return true;
+    case 'g': {
+        char regs[REG_COUNT * 4 + 1];
+        memset(regs, '0', REG_COUNT * 4);
+        regs[REG_COUNT * 4] = '\0';
+        reply_host(regs);
+        return true;
+    }
+    case 'H':
+    case 'D':
+        reply_host("OK");
+        return true;
+    case 'k':
+        // Nothing to kill, and GDB doesn't wait for a reply
+        return true;
+    case 'm':
+    case 'M':
+    case 'X':
+    case 'p':
+    case 'P':
+    case 'Z':
+    case 'z':
+        reply_host("E01");
+        return true;
+    case 'q':
+    case 'Q':
+        reply_host(strcmp(payload, "qAttached") == 0 ? "1" : "");
+        return true;
+    case 'v':
+        if(strncmp(payload, "vCont;", 6) == 0) {
+            break;
+        }
+        reply_host("");
+        return true;
+    }
+
+    // c, s and the like wait for the stub to start
+    return false;
+}
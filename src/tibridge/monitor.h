@@ -0,0 +1,36 @@
+#ifndef __TIBRIDGE_MONITOR_H__
+#define __TIBRIDGE_MONITOR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * GDB monitor commands (qRcmd) that drive the calculator over the cable the
+ * bridge already has open:
+ *
+ *   monitor keys TEXT
+ *   monitor macro SCRIPT
+ *   monitor launch [SUBTYPE] PROGRAM
+ *   monitor screenshot FILE
+ *
+ * These need the OS to own the link, which it only does while no stub is
+ * attached: before the program is started, or after it has exited. Pass
+ * link_free when that's the case. Otherwise they're refused with an E01
+ * and a message saying why, because the stub would take OS packets for
+ * garbage.
+ *
+ * Returns true if the packet was answered by the bridge.
+ */
+bool monitor_handle_packet(const uint8_t* send, int sendCount, bool link_free);
+
+/**
+ * Answer GDB's connection packets while no stub is attached, as if for a
+ * target stopped with nothing in it, so GDB gets as far as a prompt and
+ * monitor commands. Anything that would resume the target is left for the
+ * stub, which answers it once it's started.
+ *
+ * Returns true if the packet was answered by the bridge.
+ */
+bool monitor_handle_detached(const uint8_t* send, int sendCount);
+
+#endif
@@ -0,0 +1,232 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib-2.0/glib.h>
+
+#include "link.h"
+#include "target.h"
+#include "symbols.h"
+#include "../common/utils.h"
+
+#define PROFILE_INTERVAL_START 100
+#define PROFILE_INTERVAL_MIN 10
+#define PROFILE_INTERVAL_MAX 5000
+
+static ProfileOptions options;
+static bool enabled = false;
+
+static uint32_t pc_samples[0x10000];
+static uint64_t sample_count = 0;
+// Folded call chain -> number of samples
+static GHashTable *stacks = NULL;
+
+static double stopped_avg_ms = 0;
+static uint64_t interval_ms = PROFILE_INTERVAL_START;
+
+void profile_init(const ProfileOptions* opts) {
+    options = *opts;
+    if(options.budget == 0 || options.budget >= 100) {
+        options.budget = PROFILE_BUDGET_DEFAULT;
+    }
+    if(options.stack_depth > PROFILE_STACK_MAX) {
+        options.stack_depth = PROFILE_STACK_MAX;
+    }
+
+    enabled = options.prefix != NULL;
+    if(enabled) {
+        stacks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+}
+
+static void symbolize(uint16_t addr, char* buf, size_t size) {
+    const char *name = symbols_lookup(addr);
+    if(name) {
+        snprintf(buf, size, "%s", name);
+    }
+    else {
+        // Lump anything we don't know by page so the profile stays readable
+        snprintf(buf, size, "0x%04x", addr & 0xff00);
+    }
+}
+
+static bool sample(const char* reply) {
+    uint16_t pc, sp = 0;
+    if(
+        !target_stop_register(reply, REG_PC, &pc)
+        || (options.stack_depth && !target_stop_register(reply, REG_SP, &sp))
+    ) {
+        uint16_t regs[REG_PC + 1];
+        if(target_read_registers(regs, REG_PC + 1) <= REG_PC) {
+            return false;
+        }
+        pc = regs[REG_PC];
+        sp = regs[REG_SP];
+    }
+
+    pc_samples[pc]++;
+    sample_count++;
+
+    // There are no frame pointers to follow, so any stack word that lands in
+    // a known symbol is taken to be a return address.
+    GString *chain = g_string_new(NULL);
+    uint8_t stack[PROFILE_STACK_MAX * 2];
+    if(options.stack_depth && target_read_memory(sp, stack, options.stack_depth * 2)) {
+        for(int i = options.stack_depth - 1; i >= 0; i--) {
+            const char *name = symbols_lookup(stack[i * 2] | (stack[i * 2 + 1] << 8));
+            if(name) {
+                g_string_append(chain, name);
+                g_string_append_c(chain, ';');
+            }
+        }
+    }
+
+    char name[256];
+    symbolize(pc, name, sizeof(name));
+    g_string_append(chain, name);
+
+    gpointer count = g_hash_table_lookup(stacks, chain->str);
+    g_hash_table_insert(stacks, g_string_free(chain, FALSE), GUINT_TO_POINTER(GPOINTER_TO_UINT(count) + 1));
+
+    return true;
+}
+
+static void adapt_interval(uint64_t stopped_ms) {
+    if(sample_count <= 1) {
+        stopped_avg_ms = stopped_ms;
+    }
+    else {
+        stopped_avg_ms = stopped_avg_ms * 0.8 + stopped_ms * 0.2;
+    }
+
+    interval_ms = stopped_avg_ms * (100 - options.budget) / options.budget;
+    if(interval_ms < PROFILE_INTERVAL_MIN) {
+        interval_ms = PROFILE_INTERVAL_MIN;
+    }
+    if(interval_ms > PROFILE_INTERVAL_MAX) {
+        interval_ms = PROFILE_INTERVAL_MAX;
+    }
+
+    log(LEVEL_TRACE, "Sample took %lums, next in %lums\n", (unsigned long)stopped_ms, (unsigned long)interval_ms);
+}
+
+static void profile_resume(void) {
+    char reply[PACKET_MAX + 1];
+    ResumeState state = { 0 };
+
+    while(true) {
+        state.interrupt_at = utils_now_ms() + interval_ms;
+        if(calc_resume("c", reply, sizeof(reply), &state) < 0) {
+            reply_host("E01");
+            break;
+        }
+
+        int sig = target_stop_signal(reply);
+        uint16_t pc;
+        bool ours = state.interrupted && !state.host_interrupted && (
+            sig == 2
+            || (sig == 5 && target_stop_pc(reply, &pc) && !target_is_breakpoint(pc))
+        );
+        if(!ours || !sample(reply)) {
+            reply_host(reply);
+            break;
+        }
+
+        adapt_interval(utils_now_ms() - state.interrupted_at);
+    }
+
+    log(LEVEL_INFO, "Profiled %lu samples\n", (unsigned long)sample_count);
+    profile_write();
+}
+
+bool profile_handle_packet(const uint8_t* send, int sendCount) {
+    char payload[PACKET_MAX + 1];
+    if(!enabled || packet_payload(send, sendCount, payload, sizeof(payload)) <= 0) {
+        return false;
+    }
+
+    if(strcmp(payload, "c") == 0) {
+        profile_resume();
+        return true;
+    }
+
+    return false;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t count;
+} FlatEntry;
+
+static int compare_flat(const void *a, const void *b) {
+    return (int)((const FlatEntry*)b)->count - (int)((const FlatEntry*)a)->count;
+}
+
+static void write_folded(gpointer key, gpointer value, gpointer user_data) {
+    fprintf((FILE*)user_data, "%s %u\n", (const char*)key, GPOINTER_TO_UINT(value));
+}
+
+bool profile_write(void) {
+    if(!enabled || sample_count == 0) {
+        return true;
+    }
+
+    GHashTable *flat = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for(uint32_t pc = 0; pc < 0x10000; pc++) {
+        if(!pc_samples[pc]) {
+            continue;
+        }
+
+        char name[256];
+        symbolize(pc, name, sizeof(name));
+        gpointer count = g_hash_table_lookup(flat, name);
+        g_hash_table_replace(flat, g_strdup(name), GUINT_TO_POINTER(GPOINTER_TO_UINT(count) + pc_samples[pc]));
+    }
+
+    guint n = g_hash_table_size(flat);
+    FlatEntry *entries = malloc(n * sizeof(FlatEntry));
+    GHashTableIter iter;
+    gpointer key, value;
+    int i = 0;
+    g_hash_table_iter_init(&iter, flat);
+    while(g_hash_table_iter_next(&iter, &key, &value)) {
+        entries[i].name = key;
+        entries[i].count = GPOINTER_TO_UINT(value);
+        i++;
+    }
+    qsort(entries, n, sizeof(FlatEntry), compare_flat);
+
+    bool ok = true;
+    char *path = g_strdup_printf("%s.flat", options.prefix);
+    FILE *f = fopen(path, "w");
+    if(f == NULL) {
+        log(LEVEL_ERROR, "Could not write profile: %s\n", path);
+        ok = false;
+    }
+    else {
+        fprintf(f, "# %lu samples, %u%% overhead budget\n", (unsigned long)sample_count, options.budget);
+        fprintf(f, "# %%       samples  symbol\n");
+        for(i = 0; i < n; i++) {
+            fprintf(f, "%7.2f %9u  %s\n", 100.0 * entries[i].count / sample_count, entries[i].count, entries[i].name);
+        }
+        fclose(f);
+    }
+    g_free(path);
+    free(entries);
+    g_hash_table_destroy(flat);
+
+    path = g_strdup_printf("%s.folded", options.prefix);
+    FILE *folded = fopen(path, "w");
+    if(folded == NULL) {
+        log(LEVEL_ERROR, "Could not write profile: %s\n", path);
+        ok = false;
+    }
+    else {
+        g_hash_table_foreach(stacks, write_folded, folded);
+        fclose(folded);
+    }
+    g_free(path);
+
+    return ok;
+}
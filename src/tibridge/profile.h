@@ -0,0 +1,32 @@
+#ifndef __TIBRIDGE_PROFILE_H__
+#define __TIBRIDGE_PROFILE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PROFILE_BUDGET_DEFAULT 10
+#define PROFILE_STACK_MAX 16
+
+typedef struct {
+    // Where to write PREFIX.flat and PREFIX.folded
+    const char* prefix;
+    // Percentage of time the target may spend stopped for sampling
+    unsigned int budget;
+    // Stack words read per sample for call chains, 0 for flat samples only
+    unsigned int stack_depth;
+} ProfileOptions;
+
+void profile_init(const ProfileOptions* options);
+
+/**
+ * While profiling, a continue from GDB is turned into a loop of continue,
+ * break, sample. The time between breaks is chosen from the measured cost of
+ * a sample so that the target stays stopped for at most the budget.
+ *
+ * Returns true if the packet was answered by the bridge.
+ */
+bool profile_handle_packet(const uint8_t* send, int sendCount);
+
+bool profile_write(void);
+
+#endif
@@ -0,0 +1,88 @@
+#include "run.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "link.h"
+#include "../common/utils.h"
+#include "../common/calc.h"
+#include "../common/launch.h"
+
+static char stop_reply[PACKET_MAX + 1];
+static bool have_stop_reply = false;
+
+bool run_start(const char* subtype, const char* program) {
+    // ion and MirageOS only open the shell, so no stub would ever speak
+    if(strcmp(subtype, "noshell") != 0) {
+        log(LEVEL_ERROR, "--run only starts programs with noshell, not %s\n", subtype);
+        return false;
+    }
+
+    log(LEVEL_INFO, "Starting %s\n", program);
+
+    // The bridge waits for the stub forever, but key presses shouldn't
+    int timeout = cable_handle->timeout;
+    ticables_options_set_timeout(cable_handle, CABLE_TIMEOUT);
+    int err = launch_program(&calc_session, subtype, program, true);
+    ticables_options_set_timeout(cable_handle, timeout);
+    if(err) {
+        log(LEVEL_ERROR, "Could not start %s\n", program);
+        return false;
+    }
+
+    log(LEVEL_INFO, "Waiting for the stub\n");
+    while(true) {
+        uint8_t recv[PACKET_MAX + 1];
+        int recvCount = read_calc_unit(recv, sizeof(recv));
+        if(recvCount < 0) {
+            nack();
+            continue;
+        }
+
+        if(recvCount == 1) {
+            if(recv[0] == '-') {
+                // The stub is ready for a command
+                break;
+            }
+            continue;
+        }
+
+        ack();
+
+        char payload[PACKET_MAX + 1];
+        int len = packet_payload(recv, recvCount, payload, sizeof(payload));
+        if(len < 0) {
+            continue;
+        }
+
+        if(payload[0] == 'O' && len >= 3 && (len - 1) % 2 == 0) {
+            int data_size = (len - 1) / 2;
+            char buf[data_size];
+            hex2mem(&payload[1], buf, data_size);
+            log(LEVEL_INFO, "\n%.*s", data_size, buf);
+            continue;
+        }
+
+        log(LEVEL_DEBUG, "Keeping the stub's stop reply for GDB: %s\n", payload);
+        memcpy(stop_reply, payload, len + 1);
+        have_stop_reply = true;
+    }
+
+    log(LEVEL_INFO, "%s is running, waiting for GDB\n", program);
+    return true;
+}
+
+bool run_handle_packet(const uint8_t* send, int sendCount) {
+    if(!have_stop_reply) {
+        return false;
+    }
+
+    char payload[PACKET_MAX + 1];
+    if(packet_payload(send, sendCount, payload, sizeof(payload)) != 1 || payload[0] != '?') {
+        return false;
+    }
+
+    have_stop_reply = false;
+    reply_host(stop_reply);
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef __TIBRIDGE_RUN_H__
+#define __TIBRIDGE_RUN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Start a program over the bridge's own link, so nothing else has to open
+ * the cable first and hand it over.
+ *
+ * The program is started without waiting for the OS's ACK, and everything
+ * the stub sends while it comes up is read here, until it asks for its
+ * first command. Its stop reply is kept to answer GDB's first '?', so the
+ * relay can start in the send phase with nothing left over on the link.
+ *
+ * Only the noshell subtype starts the program itself, so it's the only one
+ * allowed. Returns false if the program couldn't be started.
+ */
+bool run_start(const char* subtype, const char* program);
+
+/**
+ * Answer GDB's first '?' with the stop reply the stub sent at start up.
+ */
+bool run_handle_packet(const uint8_t* send, int sendCount);
+
+#endif
@@ -0,0 +1,81 @@
+#include "symbols.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/utils.h"
+
+// Anything further than this past the last symbol isn't ours
+#define SYMBOL_TAIL_MAX 0x400
+
+typedef struct {
+    uint16_t addr;
+    char *name;
+} Symbol;
+
+static Symbol *symbols = NULL;
+static int symbol_count = 0;
+
+static int compare_symbols(const void *a, const void *b) {
+    return (int)((const Symbol*)a)->addr - (int)((const Symbol*)b)->addr;
+}
+
+bool symbols_load(const char* path) {
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+        log(LEVEL_ERROR, "Could not open map file: %s\n", path);
+        return false;
+    }
+
+    int capacity = 0;
+    char line[512];
+    while(fgets(line, sizeof(line), f)) {
+        char name[256];
+        unsigned int addr;
+        char type[32];
+        if(sscanf(line, "%255s = $%x ; %31[a-z]", name, &addr, type) != 3 || strcmp(type, "addr") != 0) {
+            continue;
+        }
+
+        if(symbol_count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            symbols = realloc(symbols, capacity * sizeof(Symbol));
+        }
+
+        symbols[symbol_count].addr = addr;
+        symbols[symbol_count].name = strdup(name);
+        symbol_count++;
+    }
+    fclose(f);
+
+    qsort(symbols, symbol_count, sizeof(Symbol), compare_symbols);
+
+    log(LEVEL_INFO, "Loaded %d symbols from %s\n", symbol_count, path);
+
+    return symbol_count > 0;
+}
+
+const char* symbols_lookup(uint16_t addr) {
+    if(symbol_count == 0 || addr < symbols[0].addr) {
+        return NULL;
+    }
+
+    int lo = 0;
+    int hi = symbol_count - 1;
+    while(lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if(symbols[mid].addr <= addr) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+
+    if(lo == symbol_count - 1 && addr - symbols[lo].addr > SYMBOL_TAIL_MAX) {
+        return NULL;
+    }
+
+    return symbols[lo].name;
+}
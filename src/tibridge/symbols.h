@@ -0,0 +1,19 @@
+#ifndef __TIBRIDGE_SYMBOLS_H__
+#define __TIBRIDGE_SYMBOLS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Load the address symbols out of a z88dk map file, lines like
+ * _main = $9D95 ; addr, public, , main_c, code_compiler, main.c:12
+ */
+bool symbols_load(const char* path);
+
+/**
+ * Name of the symbol that contains addr, or NULL if it's before all of them
+ * or too far past the last one to plausibly belong to it.
+ */
+const char* symbols_lookup(uint16_t addr);
+
+#endif
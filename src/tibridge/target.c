@@ -0,0 +1,155 @@
+#include "target.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "link.h"
+#include "../common/utils.h"
+
+static uint16_t breakpoints[BREAKPOINT_MAX];
+static int breakpoint_count = 0;
+
+void target_track_breakpoint(bool insert, uint16_t addr) {
+    for(int i = 0; i < breakpoint_count; i++) {
+        if(breakpoints[i] == addr) {
+            if(!insert) {
+                breakpoints[i] = breakpoints[--breakpoint_count];
+            }
+            return;
+        }
+    }
+
+    if(insert && breakpoint_count < BREAKPOINT_MAX) {
+        breakpoints[breakpoint_count++] = addr;
+    }
+}
+
+bool target_is_breakpoint(uint16_t addr) {
+    for(int i = 0; i < breakpoint_count; i++) {
+        if(breakpoints[i] == addr) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool target_has_breakpoints(void) {
+    return breakpoint_count > 0;
+}
+
+int target_read_registers(uint16_t* regs, int count) {
+    char reply[PACKET_MAX + 1];
+    int len = calc_command("g", reply, sizeof(reply));
+    if(len <= 0 || reply[0] == 'E') {
+        log(LEVEL_ERROR, "Could not read registers: %s\n", len > 0 ? reply : "");
+        return -1;
+    }
+
+    int n;
+    for(n = 0; n < count && (n + 1) * 4 <= len; n++) {
+        uint8_t bytes[2];
+        hex2mem(&reply[n * 4], (char*)bytes, 2);
+        regs[n] = bytes[0] | (bytes[1] << 8);
+    }
+
+    return n;
+}
+
+bool target_read_memory(uint16_t addr, uint8_t* buf, uint32_t len) {
+    char cmd[32];
+    char reply[PACKET_MAX + 1];
+    uint32_t done = 0;
+
+    while(done < len) {
+        uint32_t chunk = len - done;
+        if(chunk > TARGET_MEM_CHUNK) {
+            chunk = TARGET_MEM_CHUNK;
+        }
+
+        sprintf(cmd, "m%x,%x", (uint16_t)(addr + done), chunk);
+        int replyCount = calc_command(cmd, reply, sizeof(reply));
+        if(replyCount != chunk * 2) {
+            log(LEVEL_ERROR, "Could not read memory at %04x: %s\n", (uint16_t)(addr + done), replyCount > 0 ? reply : "");
+            return false;
+        }
+
+        hex2mem(reply, (char*)&buf[done], chunk);
+        done += chunk;
+    }
+
+    return true;
+}
+
+bool target_write_memory(uint16_t addr, const uint8_t* buf, uint32_t len) {
+    char cmd[PACKET_MAX + 1];
+    char reply[16];
+    uint32_t done = 0;
+
+    while(done < len) {
+        uint32_t chunk = len - done;
+        if(chunk > TARGET_MEM_CHUNK) {
+            chunk = TARGET_MEM_CHUNK;
+        }
+
+        int n = sprintf(cmd, "M%x,%x:", (uint16_t)(addr + done), chunk);
+        mem2hex((const char*)&buf[done], &cmd[n], chunk);
+        if(calc_command(cmd, reply, sizeof(reply)) < 0 || strcmp(reply, "OK") != 0) {
+            log(LEVEL_ERROR, "Could not write memory at %04x\n", (uint16_t)(addr + done));
+            return false;
+        }
+
+        done += chunk;
+    }
+
+    return true;
+}
+
+int target_stop_signal(const char* reply) {
+    if((reply[0] != 'S' && reply[0] != 'T') || hex(reply[1]) < 0 || hex(reply[2]) < 0) {
+        return -1;
+    }
+
+    return (hex(reply[1]) << 4) | hex(reply[2]);
+}
+
+bool target_stop_register(const char* reply, TARGET_REG reg, uint16_t* value) {
+    if(reply[0] != 'T') {
+        return false;
+    }
+
+    const char *pair = &reply[3];
+    while(*pair) {
+        unsigned int num;
+        char bytes[4];
+        int consumed = 0;
+        if(sscanf(pair, "%x:%4[0-9a-fA-F]%n", &num, bytes, &consumed) == 2 && num == reg && consumed > 0 && strlen(bytes) == 4) {
+            uint8_t raw[2];
+            hex2mem(bytes, (char*)raw, 2);
+            *value = raw[0] | (raw[1] << 8);
+            return true;
+        }
+
+        pair = strchr(pair, ';');
+        if(pair == NULL) {
+            break;
+        }
+        pair++;
+    }
+
+    return false;
+}
+
+bool target_stop_pc(const char* reply, uint16_t* pc) {
+    if(reply && target_stop_register(reply, REG_PC, pc)) {
+        return true;
+    }
+
+    uint16_t regs[REG_PC + 1];
+    if(target_read_registers(regs, REG_PC + 1) <= REG_PC) {
+        return false;
+    }
+
+    *pc = regs[REG_PC];
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef __TIBRIDGE_TARGET_H__
+#define __TIBRIDGE_TARGET_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Register order of the z80 target in GDB's g packet
+typedef enum {
+    REG_AF,
+    REG_BC,
+    REG_DE,
+    REG_HL,
+    REG_SP,
+    REG_PC,
+    REG_IX,
+    REG_IY,
+    REG_AF2,
+    REG_BC2,
+    REG_DE2,
+    REG_HL2,
+    REG_IR,
+    REG_COUNT,
+} TARGET_REG;
+
+#define BREAKPOINT_MAX 64
+
+// Bytes per m/M packet. 2 hex characters per byte must fit in PACKET_MAX.
+#define TARGET_MEM_CHUNK 256
+
+int target_read_registers(uint16_t* regs, int count);
+bool target_read_memory(uint16_t addr, uint8_t* buf, uint32_t len);
+bool target_write_memory(uint16_t addr, const uint8_t* buf, uint32_t len);
+
+/**
+ * Parse the signal out of a stop reply (S05, T05...). Returns -1 for anything
+ * else, such as an exit (W/X) or an error.
+ */
+int target_stop_signal(const char* reply);
+
+/**
+ * Find a register in the nn:value pairs of a T stop reply, so we can skip a
+ * g packet when the stub already told us.
+ */
+bool target_stop_register(const char* reply, TARGET_REG reg, uint16_t* value);
+
+/**
+ * PC at a stop, from the stop reply if it has it or else from a g packet.
+ * reply may be NULL.
+ */
+bool target_stop_pc(const char* reply, uint16_t* pc);
+
+/**
+ * Breakpoints GDB set through the stub. The bridge needs them to tell its
+ * own stops apart from the ones GDB is waiting for.
+ */
+void target_track_breakpoint(bool insert, uint16_t addr);
+bool target_is_breakpoint(uint16_t addr);
+bool target_has_breakpoints(void);
+
+#endif
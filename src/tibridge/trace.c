@@ -0,0 +1,638 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "link.h"
+#include "target.h"
+#include "../common/utils.h"
+
+typedef struct {
+    // Register the offset is relative to, or -1 for an absolute address
+    int basereg;
+    uint32_t offset;
+    uint16_t len;
+} TraceBlock;
+
+typedef struct {
+    uint32_t num;
+    uint16_t addr;
+    bool enabled;
+    uint32_t pass;
+    uint32_t hits;
+    bool collect_regs;
+    TraceBlock blocks[TRACE_BLOCK_MAX];
+    int block_count;
+} Tracepoint;
+
+typedef struct {
+    uint32_t tracepoint;
+    bool has_regs;
+    uint16_t regs[REG_COUNT];
+    int block_count;
+    struct {
+        uint16_t addr;
+        uint16_t len;
+        uint8_t *data;
+    } blocks[TRACE_BLOCK_MAX];
+    size_t size;
+} TraceFrame;
+
+static Tracepoint tracepoints[TRACEPOINT_MAX];
+static int tracepoint_count = 0;
+
+static TraceFrame* frames[TRACE_FRAME_MAX];
+static int frame_first = 0;
+static int frame_count = 0;
+static size_t frame_bytes = 0;
+static size_t buffer_size = TRACE_BUFFER_DEFAULT;
+static uint32_t frames_created = 0;
+static int current_frame = -1;
+
+static bool running = false;
+static char stop_reason[32] = "tnotrun:0";
+
+static TraceFrame* frame_at(int i) {
+    return frames[(frame_first + i) % TRACE_FRAME_MAX];
+}
+
+static void drop_oldest_frame(void) {
+    TraceFrame *f = frames[frame_first];
+    frame_bytes -= f->size;
+    free(f);
+    frame_first = (frame_first + 1) % TRACE_FRAME_MAX;
+    frame_count--;
+}
+
+static void clear_frames(void) {
+    while(frame_count > 0) {
+        drop_oldest_frame();
+    }
+    frame_first = 0;
+    frames_created = 0;
+    current_frame = -1;
+}
+
+static void push_frame(TraceFrame* f) {
+    if(f->size > buffer_size) {
+        log(LEVEL_WARN, "Trace frame for tracepoint %u is bigger than the buffer, dropping it\n", f->tracepoint);
+        free(f);
+        return;
+    }
+
+    while(frame_count > 0 && (frame_count == TRACE_FRAME_MAX || frame_bytes + f->size > buffer_size)) {
+        drop_oldest_frame();
+    }
+
+    frames[(frame_first + frame_count) % TRACE_FRAME_MAX] = f;
+    frame_count++;
+    frame_bytes += f->size;
+    frames_created++;
+}
+
+static Tracepoint* find_tracepoint_num(uint32_t num) {
+    for(int i = 0; i < tracepoint_count; i++) {
+        if(tracepoints[i].num == num) {
+            return &tracepoints[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool is_tracepoint_addr(uint16_t addr) {
+    for(int i = 0; i < tracepoint_count; i++) {
+        if(tracepoints[i].enabled && tracepoints[i].addr == addr) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool set_breakpoints(bool insert) {
+    char cmd[32];
+    char reply[16];
+    bool ok = true;
+
+    for(int i = 0; i < tracepoint_count; i++) {
+        // GDB's own breakpoint is already in the stub, and stays after the trace
+        if(!tracepoints[i].enabled || target_is_breakpoint(tracepoints[i].addr)) {
+            continue;
+        }
+
+        sprintf(cmd, "%c0,%x,1", insert ? 'Z' : 'z', tracepoints[i].addr);
+        if(calc_command(cmd, reply, sizeof(reply)) < 0 || strcmp(reply, "OK") != 0) {
+            log(LEVEL_ERROR, "Could not %s tracepoint at %04x\n", insert ? "insert" : "remove", tracepoints[i].addr);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static void stop_trace(const char* reason) {
+    if(running) {
+        set_breakpoints(false);
+        running = false;
+    }
+    snprintf(stop_reason, sizeof(stop_reason), "%s", reason);
+}
+
+/**
+ * Step off a tracepoint. While a trace runs, the stub breakpoint at each
+ * tracepoint belongs to the tracer: GDB's Z0/z0 there are only tracked (see
+ * trace_handle_packet), so lifting it for the step is invisible to GDB.
+ */
+static bool step_over(uint16_t addr, char* reply, int size) {
+    char cmd[32];
+    char ok[16];
+
+    sprintf(cmd, "z0,%x,1", addr);
+    calc_command(cmd, ok, sizeof(ok));
+
+    int replyCount = calc_command("s", reply, size);
+
+    sprintf(cmd, "Z0,%x,1", addr);
+    calc_command(cmd, ok, sizeof(ok));
+
+    return replyCount >= 0;
+}
+
+/**
+ * Look at where a step over a tracepoint stopped. Returns false once a stop
+ * GDB has to see, such as a signal or one of its breakpoints, was reported.
+ */
+static bool stepped_to(const char* reply, uint16_t* pc) {
+    if(target_stop_signal(reply) != 5 || !target_stop_pc(reply, pc) || target_is_breakpoint(*pc)) {
+        reply_host(reply);
+        return false;
+    }
+
+    return true;
+}
+
+static void collect(uint16_t pc) {
+    uint16_t regs[REG_COUNT];
+    bool has_regs = false;
+
+    for(int i = 0; i < tracepoint_count; i++) {
+        Tracepoint *tp = &tracepoints[i];
+        if(!tp->enabled || tp->addr != pc) {
+            continue;
+        }
+
+        bool need_regs = tp->collect_regs;
+        size_t size = sizeof(TraceFrame);
+        for(int b = 0; b < tp->block_count; b++) {
+            size += tp->blocks[b].len;
+            need_regs |= tp->blocks[b].basereg >= 0;
+        }
+
+        if(need_regs && !has_regs) {
+            has_regs = target_read_registers(regs, REG_COUNT) == REG_COUNT;
+        }
+
+        TraceFrame *f = calloc(1, size);
+        f->tracepoint = tp->num;
+        f->size = size;
+        if(need_regs && has_regs) {
+            f->has_regs = true;
+            memcpy(f->regs, regs, sizeof(regs));
+        }
+        else {
+            f->regs[REG_PC] = pc;
+        }
+
+        uint8_t *data = (uint8_t*)&f[1];
+        for(int b = 0; b < tp->block_count; b++) {
+            TraceBlock *tb = &tp->blocks[b];
+            uint16_t addr = tb->offset;
+            if(tb->basereg >= 0) {
+                if(!has_regs || tb->basereg >= REG_COUNT) {
+                    continue;
+                }
+                addr += regs[tb->basereg];
+            }
+
+            if(!target_read_memory(addr, data, tb->len)) {
+                continue;
+            }
+
+            f->blocks[f->block_count].addr = addr;
+            f->blocks[f->block_count].len = tb->len;
+            f->blocks[f->block_count].data = data;
+            f->block_count++;
+            data += tb->len;
+        }
+
+        push_frame(f);
+        tp->hits++;
+
+        log(LEVEL_DEBUG, "Tracepoint %u hit at %04x (%u)\n", tp->num, pc, tp->hits);
+
+        if(tp->pass && tp->hits >= tp->pass) {
+            char reason[32];
+            sprintf(reason, "tpasscount:%x", tp->num);
+            stop_trace(reason);
+        }
+    }
+}
+
+static void trace_resume(void) {
+    char reply[PACKET_MAX + 1];
+    ResumeState state = { 0 };
+    uint16_t pc;
+    bool at_tracepoint = false;
+
+    // Don't immediately hit the breakpoint we're sitting on
+    if(target_stop_pc(NULL, &pc) && is_tracepoint_addr(pc)) {
+        if(!step_over(pc, reply, sizeof(reply))) {
+            reply_host("E01");
+            return;
+        }
+        if(!stepped_to(reply, &pc)) {
+            return;
+        }
+        at_tracepoint = running && is_tracepoint_addr(pc);
+    }
+
+    while(true) {
+        if(!at_tracepoint) {
+            if(calc_resume("c", reply, sizeof(reply), &state) < 0) {
+                reply_host("E01");
+                return;
+            }
+
+            if(
+                state.host_interrupted
+                || target_stop_signal(reply) != 5
+                || !running
+                || !target_stop_pc(reply, &pc)
+                || !is_tracepoint_addr(pc)
+            ) {
+                reply_host(reply);
+                return;
+            }
+        }
+
+        collect(pc);
+
+        if(target_is_breakpoint(pc)) {
+            // GDB has a breakpoint here too, so this is its stop
+            reply_host(reply);
+            return;
+        }
+
+        // Once the pass count stops the trace its breakpoints are gone
+        at_tracepoint = false;
+        if(running) {
+            if(!step_over(pc, reply, sizeof(reply))) {
+                reply_host("E01");
+                return;
+            }
+            if(!stepped_to(reply, &pc)) {
+                return;
+            }
+            at_tracepoint = running && is_tracepoint_addr(pc);
+        }
+    }
+}
+
+static void define_tracepoint(const char* args) {
+    unsigned int num, step, pass;
+    unsigned long long addr;
+    char enabled;
+    if(sscanf(args, "%x:%llx:%c:%x:%x", &num, &addr, &enabled, &step, &pass) != 5) {
+        reply_host("E01");
+        return;
+    }
+
+    if(step) {
+        log(LEVEL_WARN, "While-stepping isn't supported on tracepoint %u\n", num);
+        reply_host("E01");
+        return;
+    }
+
+    Tracepoint *tp = find_tracepoint_num(num);
+    if(tp == NULL) {
+        if(tracepoint_count >= TRACEPOINT_MAX) {
+            reply_host("E01");
+            return;
+        }
+        tp = &tracepoints[tracepoint_count++];
+    }
+
+    memset(tp, 0, sizeof(*tp));
+    tp->num = num;
+    tp->addr = addr;
+    tp->enabled = enabled == 'E';
+    tp->pass = pass;
+
+
+    reply_host("OK");
+}
+
+static void define_actions(const char* args) {
+    unsigned int num;
+    unsigned long long addr;
+    int consumed = 0;
+    if(sscanf(args, "%x:%llx:%n", &num, &addr, &consumed) != 2 || !consumed) {
+        reply_host("E01");
+        return;
+    }
+
+    Tracepoint *tp = find_tracepoint_num(num);
+    if(tp == NULL) {
+        reply_host("E01");
+        return;
+    }
+
+    const char *p = &args[consumed];
+    while(*p && *p != '-') {
+        char *end;
+        if(*p == 'R') {
+            strtoul(&p[1], &end, 16);
+            tp->collect_regs = true;
+            p = end;
+        }
+        else if(*p == 'M') {
+            long basereg = strtol(&p[1], &end, 16);
+            if(*end != ',') {
+                break;
+            }
+            unsigned long long offset = strtoull(&end[1], &end, 16);
+            if(*end != ',') {
+                break;
+            }
+            unsigned long len = strtoul(&end[1], &end, 16);
+            p = end;
+
+            if(tp->block_count >= TRACE_BLOCK_MAX) {
+                log(LEVEL_WARN, "Too many memory ranges for tracepoint %u\n", num);
+                continue;
+            }
+
+            TraceBlock *tb = &tp->blocks[tp->block_count++];
+            tb->basereg = (basereg < 0 || basereg == 0xffffffff) ? -1 : basereg;
+            tb->offset = offset;
+            tb->len = len > 0xffff ? 0xffff : len;
+        }
+        else if(*p == 'S') {
+            // While-stepping actions follow, which need single stepping we don't do
+            log(LEVEL_WARN, "While-stepping isn't supported on tracepoint %u\n", num);
+            reply_host("E01");
+            return;
+        }
+        else if(*p == 'X') {
+            unsigned long len = strtoul(&p[1], &end, 16);
+            p = end;
+            if(*p == ',') {
+                p++;
+            }
+            for(unsigned long i = 0; i < len * 2 && *p; i++) {
+                p++;
+            }
+            log(LEVEL_WARN, "Agent expressions aren't supported on tracepoint %u\n", num);
+        }
+        else {
+            p++;
+        }
+    }
+
+    reply_host("OK");
+}
+
+static void start_trace(void) {
+    if(running) {
+        stop_trace("tstop::0");
+    }
+
+    clear_frames();
+    for(int i = 0; i < tracepoint_count; i++) {
+        tracepoints[i].hits = 0;
+    }
+
+    if(!set_breakpoints(true)) {
+        set_breakpoints(false);
+        reply_host("E01");
+        return;
+    }
+
+    running = true;
+    reply_host("OK");
+}
+
+static void send_status(void) {
+    char status[256];
+    sprintf(
+        status,
+        "T%d;%s%stframes:%x;tcreated:%x;tfree:%zx;tsize:%zx;circular:1",
+        running,
+        running ? "" : stop_reason,
+        running ? "" : ";",
+        frame_count,
+        frames_created,
+        buffer_size > frame_bytes ? buffer_size - frame_bytes : 0,
+        buffer_size
+    );
+    reply_host(status);
+}
+
+static bool frame_matches(TraceFrame* f, const char* type, unsigned long long a, unsigned long long b) {
+    uint16_t pc = f->regs[REG_PC];
+    if(strcmp(type, "pc") == 0) {
+        return pc == a;
+    }
+    if(strcmp(type, "tdp") == 0) {
+        return f->tracepoint == a;
+    }
+    if(strcmp(type, "range") == 0) {
+        return pc >= a && pc <= b;
+    }
+    if(strcmp(type, "outside") == 0) {
+        return pc < a || pc > b;
+    }
+    return false;
+}
+
+static void select_frame(const char* args) {
+    char reply[32];
+    char type[16];
+    unsigned long long a = 0, b = 0;
+    int found = -1;
+
+    if(sscanf(args, "%15[a-z]:%llx:%llx", type, &a, &b) >= 2) {
+        for(int i = current_frame + 1; i < frame_count; i++) {
+            if(frame_matches(frame_at(i), type, a, b)) {
+                found = i;
+                break;
+            }
+        }
+    }
+    else {
+        long n = strtol(args, NULL, 16);
+        if(n >= 0 && n < frame_count) {
+            found = n;
+        }
+    }
+
+    current_frame = found;
+    if(found < 0) {
+        reply_host("F-1");
+        return;
+    }
+
+    sprintf(reply, "F%xT%x", found, frame_at(found)->tracepoint);
+    reply_host(reply);
+}
+
+static void send_frame_registers(TraceFrame* f) {
+    char reply[REG_COUNT * 4 + 1];
+    for(int i = 0; i < REG_COUNT; i++) {
+        if(f->has_regs || i == REG_PC) {
+            uint8_t bytes[2] = { f->regs[i] & 0xff, f->regs[i] >> 8 };
+            mem2hex((const char*)bytes, &reply[i * 4], 2);
+        }
+        else {
+            memcpy(&reply[i * 4], "xxxx", 5);
+        }
+    }
+    reply_host(reply);
+}
+
+static void send_frame_memory(TraceFrame* f, const char* args) {
+    unsigned int addr, len;
+    if(sscanf(args, "%x,%x", &addr, &len) != 2 || len > TARGET_MEM_CHUNK) {
+        reply_host("E01");
+        return;
+    }
+
+    for(int b = 0; b < f->block_count; b++) {
+        if(addr >= f->blocks[b].addr && addr + len <= f->blocks[b].addr + f->blocks[b].len) {
+            char reply[TARGET_MEM_CHUNK * 2 + 1];
+            mem2hex((const char*)&f->blocks[b].data[addr - f->blocks[b].addr], reply, len);
+            reply_host(reply);
+            return;
+        }
+    }
+
+    reply_host("E01");
+}
+
+bool trace_handle_packet(const uint8_t* send, int sendCount) {
+    char payload[PACKET_MAX + 1];
+    int len = packet_payload(send, sendCount, payload, sizeof(payload));
+    if(len <= 0) {
+        return false;
+    }
+
+    if(running && (strncmp(payload, "Z0,", 3) == 0 || strncmp(payload, "z0,", 3) == 0)) {
+        unsigned int addr;
+        if(sscanf(&payload[3], "%x", &addr) != 1 || !is_tracepoint_addr(addr)) {
+            return false;
+        }
+
+        // watch_handle_packet tracked it. The stub already has a breakpoint
+        // here, which the tracer keeps until the trace stops.
+        reply_host("OK");
+    }
+    else if(strcmp(payload, "QTinit") == 0) {
+        stop_trace("tnotrun:0");
+        clear_frames();
+        tracepoint_count = 0;
+        reply_host("OK");
+    }
+    else if(strncmp(payload, "QTDP:-", 6) == 0) {
+        define_actions(&payload[6]);
+    }
+    else if(strncmp(payload, "QTDP:", 5) == 0) {
+        define_tracepoint(&payload[5]);
+    }
+    else if(strcmp(payload, "QTStart") == 0) {
+        start_trace();
+    }
+    else if(strcmp(payload, "QTStop") == 0) {
+        stop_trace("tstop::0");
+        reply_host("OK");
+    }
+    else if(strcmp(payload, "qTStatus") == 0) {
+        send_status();
+    }
+    else if(strncmp(payload, "QTFrame:", 8) == 0) {
+        select_frame(&payload[8]);
+    }
+    else if(strncmp(payload, "QTBuffer:size:", 14) == 0) {
+        long size = strtol(&payload[14], NULL, 16);
+        buffer_size = size > 0 ? size : TRACE_BUFFER_DEFAULT;
+        reply_host("OK");
+    }
+    else if(strncmp(payload, "QTEnable:", 9) == 0 || strncmp(payload, "QTDisable:", 10) == 0) {
+        unsigned int num;
+        bool enable = payload[3] == 'E';
+        Tracepoint *tp = NULL;
+        if(sscanf(strchr(payload, ':') + 1, "%x", &num) == 1) {
+            tp = find_tracepoint_num(num);
+        }
+        if(tp == NULL || running) {
+            reply_host("E01");
+        }
+        else {
+            tp->enabled = enable;
+            reply_host("OK");
+        }
+    }
+    else if(strncmp(payload, "qTP:", 4) == 0) {
+        unsigned int num;
+        Tracepoint *tp = NULL;
+        char reply[32];
+        if(sscanf(&payload[4], "%x", &num) == 1) {
+            tp = find_tracepoint_num(num);
+        }
+        if(tp == NULL) {
+            reply_host("E01");
+        }
+        else {
+            sprintf(reply, "V%x:0", tp->hits);
+            reply_host(reply);
+        }
+    }
+    else if(
+        strcmp(payload, "qTfP") == 0 || strcmp(payload, "qTsP") == 0
+        || strcmp(payload, "qTfV") == 0 || strcmp(payload, "qTsV") == 0
+    ) {
+        reply_host("l");
+    }
+    else if(
+        strncmp(payload, "QTBuffer:", 9) == 0
+        || strncmp(payload, "QTDisconnected:", 15) == 0
+        || strncmp(payload, "QTro:", 5) == 0
+        || strncmp(payload, "QTDV:", 5) == 0
+        || strncmp(payload, "QTNotes:", 8) == 0
+    ) {
+        reply_host("OK");
+    }
+    else if(current_frame >= 0 && strcmp(payload, "g") == 0) {
+        send_frame_registers(frame_at(current_frame));
+    }
+    else if(current_frame >= 0 && payload[0] == 'm') {
+        send_frame_memory(frame_at(current_frame), &payload[1]);
+    }
+    else if(running && strcmp(payload, "c") == 0) {
+        trace_resume();
+    }
+    else if(running && strcmp(payload, "s") == 0) {
+        char reply[PACKET_MAX + 1];
+        uint16_t pc;
+        if(!target_stop_pc(NULL, &pc) || !is_tracepoint_addr(pc)) {
+            return false;
+        }
+        reply_host(step_over(pc, reply, sizeof(reply)) ? reply : "E01");
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef __TIBRIDGE_TRACE_H__
+#define __TIBRIDGE_TRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACEPOINT_MAX 32
+#define TRACE_BLOCK_MAX 8
+#define TRACE_FRAME_MAX 4096
+#define TRACE_BUFFER_DEFAULT (64 * 1024)
+
+/**
+ * Tracepoints are kept entirely in the bridge. While a trace is running we
+ * turn every tracepoint into a stub breakpoint, collect registers and memory
+ * when one is hit, and resume right away. Frames go into a ring buffer that
+ * drops the oldest frames once it reaches the size GDB asked for.
+ *
+ * Returns true if the packet was answered by the bridge.
+ */
+bool trace_handle_packet(const uint8_t* send, int sendCount);
+
+#endif
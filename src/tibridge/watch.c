@@ -0,0 +1,186 @@
+#include "watch.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "link.h"
+#include "target.h"
+#include "../common/utils.h"
+
+typedef struct {
+    char type;
+    uint16_t addr;
+    uint16_t len;
+    uint8_t value[WATCH_LEN_MAX];
+} Watch;
+
+static Watch watches[WATCH_MAX];
+static int watch_count = 0;
+
+bool watch_active(void) {
+    return watch_count > 0;
+}
+
+static const char* insert_watch(char type, uint16_t addr, uint16_t len) {
+    if(type == '3') {
+        // Not supported
+        return "";
+    }
+
+    if(len == 0 || len > WATCH_LEN_MAX) {
+        return "E01";
+    }
+
+    for(int i = 0; i < watch_count; i++) {
+        if(watches[i].type == type && watches[i].addr == addr && watches[i].len == len) {
+            return "OK";
+        }
+    }
+
+    if(watch_count >= WATCH_MAX) {
+        return "E01";
+    }
+
+    Watch *w = &watches[watch_count++];
+    w->type = type;
+    w->addr = addr;
+    w->len = len;
+
+    log(LEVEL_DEBUG, "Watching %d bytes at %04x\n", len, addr);
+
+    return "OK";
+}
+
+static const char* remove_watch(char type, uint16_t addr, uint16_t len) {
+    for(int i = 0; i < watch_count; i++) {
+        if(watches[i].type == type && watches[i].addr == addr && watches[i].len == len) {
+            watches[i] = watches[--watch_count];
+            return "OK";
+        }
+    }
+
+    return type == '3' ? "" : "E01";
+}
+
+static Watch* changed_watch(void) {
+    Watch *hit = NULL;
+    uint8_t current[WATCH_LEN_MAX];
+
+    for(int i = 0; i < watch_count; i++) {
+        Watch *w = &watches[i];
+        if(!target_read_memory(w->addr, current, w->len)) {
+            continue;
+        }
+
+        if(memcmp(current, w->value, w->len) != 0) {
+            memcpy(w->value, current, w->len);
+            if(hit == NULL) {
+                hit = w;
+            }
+        }
+    }
+
+    return hit;
+}
+
+static void watch_resume(bool single) {
+    char reply[PACKET_MAX + 1];
+    char stop[64];
+
+    for(int i = 0; i < watch_count; i++) {
+        if(!target_read_memory(watches[i].addr, watches[i].value, watches[i].len)) {
+            reply_host("E01");
+            return;
+        }
+    }
+
+    unsigned long steps = 0;
+    while(true) {
+        if(calc_command("s", reply, sizeof(reply)) < 0) {
+            reply_host("E01");
+            return;
+        }
+        steps++;
+
+        if(target_stop_signal(reply) != 5) {
+            // Exited, crashed or stopped for some other reason
+            reply_host(reply);
+            return;
+        }
+
+        Watch *hit = changed_watch();
+        if(hit) {
+            log(LEVEL_DEBUG, "Watchpoint at %04x hit after %lu steps\n", hit->addr, steps);
+            sprintf(stop, "T05%swatch:%x;", hit->type == '4' ? "a" : "", hit->addr);
+            reply_host(stop);
+            return;
+        }
+
+        if(single) {
+            reply_host(reply);
+            return;
+        }
+
+        if(target_has_breakpoints()) {
+            uint16_t pc;
+            if(!target_stop_pc(reply, &pc)) {
+                reply_host("E01");
+                return;
+            }
+
+            if(target_is_breakpoint(pc)) {
+                reply_host(reply);
+                return;
+            }
+        }
+
+        if(host_interrupted()) {
+            reply_host("S02");
+            return;
+        }
+    }
+}
+
+bool watch_handle_packet(const uint8_t* send, int sendCount) {
+    char payload[PACKET_MAX + 1];
+    int len = packet_payload(send, sendCount, payload, sizeof(payload));
+    if(len <= 0) {
+        return false;
+    }
+
+    if(payload[0] == 'Z' || payload[0] == 'z') {
+        bool insert = payload[0] == 'Z';
+        unsigned int addr, kind;
+        if(sscanf(&payload[1], "%*c,%x,%x", &addr, &kind) != 2) {
+            return false;
+        }
+
+        if(payload[1] == '0') {
+            target_track_breakpoint(insert, addr);
+            return false;
+        }
+
+        if(payload[1] >= '2' && payload[1] <= '4') {
+            reply_host(
+                insert
+                ? insert_watch(payload[1], addr, kind)
+                : remove_watch(payload[1], addr, kind)
+            );
+            return true;
+        }
+
+        return false;
+    }
+
+    if(watch_count > 0 && strcmp(payload, "c") == 0) {
+        watch_resume(false);
+        return true;
+    }
+
+    if(watch_count > 0 && strcmp(payload, "s") == 0) {
+        watch_resume(true);
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,22 @@
+#ifndef __TIBRIDGE_WATCH_H__
+#define __TIBRIDGE_WATCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WATCH_MAX 8
+#define WATCH_LEN_MAX 32
+
+/**
+ * The stub has no watchpoint support, so we emulate Z2 and Z4 here by single
+ * stepping the target and comparing the watched bytes after every step. Read
+ * watchpoints (Z3) can't be seen by comparing values, so they stay
+ * unsupported and GDB will tell the user so.
+ *
+ * Returns true if the packet was answered by the bridge.
+ */
+bool watch_handle_packet(const uint8_t* send, int sendCount);
+
+bool watch_active(void);
+
+#endif
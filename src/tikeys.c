@@ -1,6 +1,8 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <stdarg.h>
 
 #include <readline/readline.h>
 #include <glib-2.0/glib.h>
@@ -8,18 +10,21 @@
 #include <tilp2/ticables.h>
 #include <tilp2/ticalcs.h>
 #include <tilp2/tifiles.h>
-#include <tilp2/keys83p.h>
 #include <stdbool.h>
 
 #include "common/utils.h"
-
-#define CABLE_TIMEOUT 20
-#define CABLE_FAST_TIMEOUT 2
+#include "common/calc.h"
+#include "common/screenrec.h"
+#include "tikeys/actions.h"
+#include "tikeys/server.h"
+#include "tikeys/client.h"
+#include "tikeys/farm.h"
 
 static char *subtype = "";
 static char *program = "";
 
 static CalcModel model = CALC_TI83P;
+static CalcSession session = { 0 };
 static char *model_requested = "";
 static char *keys = "";
 static int reset_ram = 0;
@@ -30,6 +35,28 @@ static char *exists_type = "";
 static int exists_version = -1;
 static int exists_size = -1;
 
+static char *dirlist_cache = NULL;
+
+static char *macro = NULL;
+static char *script_filename = NULL;
+
+static char *sync_dir_path = NULL;
+static int sync_archive = 0;
+static int sync_unarchive = 0;
+
+static char *farm_jobs = NULL;
+
+static char *store_path = NULL;
+static char *backup_name = NULL;
+static char *restore_name = NULL;
+
+static char *record_path = NULL;
+static char *record_time = "10";
+static char *export_path = NULL;
+
+static char *serve_path = NULL;
+static char *socket_path = NULL;
+
 void show_help() {
     log(LEVEL_INFO, 
 "Syntax: tikeys [options]\n"
@@ -39,6 +66,9 @@ void show_help() {
 "[-r|--reset-ram]           reset the RAM (83p and variants)\n"
 "[-a|--reset-archive-vars]  reset the archive vars (83p and variants)\n"
 "[-k|--keys=AZ09]]          press alphanumeric keys\n"
+"[--macro=\"QUIT 'A' wait(200)\"]\n"
+"                           run a key macro. See src/common/keymacro.h\n"
+"[--script=FILE]            run a key macro from a file\n"
 "[[-s|--subtype=noshell] -p|--program=PROGNAME]\n"
 "\n"
 "[-e|--exists=FILENAME      return success if the file exists on the calculator\n"
@@ -46,6 +76,43 @@ void show_help() {
 "    [-v|--version=1]       return success only if the file version matches\n"
 "    [-z|--size=1]          return success only if the file size matches\n"
 "]\n"
+"[-d|--dirlist-cache=FILE]  keep the calculator's file list in FILE between runs.\n"
+"                           It's refetched when the free memory changes, and\n"
+"                           always before menu launches and snapshots\n"
+"\n"
+"[--sync=DIR                send the .8xp and .8xk files in DIR that changed.\n"
+"                           Files are compared with what was last synced to\n"
+"                           this calculator, and only fetched to compare when\n"
+"                           nothing's recorded, so a same-size edit made on\n"
+"                           the calculator is not resent\n"
+"    [--archive|--unarchive] and put the variables in archive or RAM\n"
+"]\n"
+"\n"
+"[--store=DIR               keep variable snapshots in DIR. See src/tikeys/snapshot.h\n"
+"    [--restore=NAME]       first put the variables back to snapshot NAME,\n"
+"                           sending only what differs\n"
+"    [--backup=NAME]        save the variables as snapshot NAME, after any\n"
+"                           resets, keys and syncs\n"
+"]\n"
+"\n"
+"[--record=FILE             record the screen to FILE after the other commands,\n"
+"    [--record-time=10]     for this many seconds\n"
+"]\n"
+"[--export=FILE             write each frame of a recording next to it, named\n"
+"                           after FILE without its extension: rec.bin gives\n"
+"                           rec-00000.png and so on, plus rec.ffconcat with\n"
+"                           their timing for ffmpeg. Needs no calculator\n"
+"]\n"
+"\n"
+"[--serve=SOCKET]           keep the cable open and take commands on a Unix\n"
+"                           socket, after running any given here\n"
+"[--socket=SOCKET]          send the commands to a server started with --serve\n"
+"                           instead of opening the cable\n"
+"[--farm=JOBS]              run the jobs in JOBS across every calculator found,\n"
+"                           after running the other commands on each of them.\n"
+"                           --record and --backup get each calculator's name\n"
+"                           added.\n"
+"                           See src/tikeys/farm.h\n"
     );
 }
 
@@ -55,6 +122,8 @@ int get_args(int argc, char *argv[]) {
         {"reset-ram", no_argument, &reset_ram, 1},
         {"reset-archive-vars", no_argument, &reset_archive_vars, 1},
         {"keys", required_argument, 0, 'k'},
+        {"macro", required_argument, 0, 'M'},
+        {"script", required_argument, 0, 'S'},
         {"subtype", required_argument, 0, 's'},
         {"program", required_argument, 0, 'p'},
 
@@ -63,6 +132,24 @@ int get_args(int argc, char *argv[]) {
         {"version", required_argument, 0, 'v'},
         {"size", required_argument, 0, 'z'},
 
+        {"dirlist-cache", required_argument, 0, 'd'},
+
+        {"sync", required_argument, 0, 'Y'},
+        {"archive", no_argument, &sync_archive, 1},
+        {"unarchive", no_argument, &sync_unarchive, 1},
+
+        {"serve", required_argument, 0, 'D'},
+        {"socket", required_argument, 0, 'O'},
+        {"farm", required_argument, 0, 'F'},
+
+        {"store", required_argument, 0, 'P'},
+        {"backup", required_argument, 0, 'B'},
+        {"restore", required_argument, 0, 'W'},
+
+        {"record", required_argument, 0, 'R'},
+        {"record-time", required_argument, 0, 'T'},
+        {"export", required_argument, 0, 'X'},
+
         {"help", no_argument, 0, 'h'},
         {0,0,0,0}
     };
@@ -70,7 +157,7 @@ int get_args(int argc, char *argv[]) {
     optind = 0;
     int opt_index = 0;
     int opt;
-    while((opt = getopt_long(argc, argv, ":c:rak:s:p:e:t:v:z:h", long_opts, &opt_index)) != -1) {
+    while((opt = getopt_long(argc, argv, ":c:rak:s:p:e:t:v:z:d:h", long_opts, &opt_index)) != -1) {
         if(optarg != NULL && strncmp(optarg, "=", 1) == 0) {
             optarg = &optarg[1];
         }
@@ -97,6 +184,12 @@ int get_args(int argc, char *argv[]) {
         else if(opt == 'k') {
             keys = optarg;
         }
+        else if(opt == 'M') {
+            macro = optarg;
+        }
+        else if(opt == 'S') {
+            script_filename = optarg;
+        }
         else if(opt == 'r') {
             reset_ram = 1;
         }
@@ -117,6 +210,44 @@ int get_args(int argc, char *argv[]) {
             sscanf(optarg, "%d", &exists_size);
         }
 
+        else if(opt == 'd') {
+            dirlist_cache = optarg;
+        }
+
+        else if(opt == 'Y') {
+            sync_dir_path = optarg;
+        }
+
+        else if(opt == 'D') {
+            serve_path = optarg;
+        }
+        else if(opt == 'O') {
+            socket_path = optarg;
+        }
+        else if(opt == 'F') {
+            farm_jobs = optarg;
+        }
+
+        else if(opt == 'P') {
+            store_path = optarg;
+        }
+        else if(opt == 'B') {
+            backup_name = optarg;
+        }
+        else if(opt == 'W') {
+            restore_name = optarg;
+        }
+
+        else if(opt == 'R') {
+            record_path = optarg;
+        }
+        else if(opt == 'T') {
+            record_time = optarg;
+        }
+        else if(opt == 'X') {
+            export_path = optarg;
+        }
+
         else if(opt == 'c') {
             model_requested = optarg;
         }
@@ -126,168 +257,163 @@ int get_args(int argc, char *argv[]) {
         }
     }
 
+    if(sync_archive && sync_unarchive) {
+        log(LEVEL_ERROR, "--archive and --unarchive can't be used together\n");
+        return EXIT_FAILURE;
+    }
+
+    if((backup_name || restore_name) && store_path == NULL) {
+        log(LEVEL_ERROR, "--backup and --restore need a --store\n");
+        return EXIT_FAILURE;
+    }
+
     return EXIT_SUCCESS;
 }
 
-static CalcHandle *calc_handle = NULL;
 static CableHandle *cable_handle = NULL;
-static const CalcKey* (*keys_func)(uint8_t ascii_code) = NULL;
 
 void cleanup() {
-    if(calc_handle) {
-        ticalcs_cable_detach(calc_handle);
-        ticalcs_handle_del(calc_handle);
-    }
+    server_stop();
+    calc_session_close(&session);
     if(cable_handle) {
         ticables_cable_close(cable_handle);
         ticables_handle_del(cable_handle);
+        cable_handle = NULL;
     }
     ticables_library_exit();
 }
 
-static void send_key(uint32_t key, int retry) {
-    usleep(100000);
-    int err;
-    while((err = ticalcs_calc_send_key(calc_handle, key) && retry));
+void handle_sigint(int code) {
+    cleanup();
 }
 
-static int compare(const void *a, const void *b) {
-    return strcmp(*(const char**)a, *(const char**)b);
-}
+static void add_command(GPtrArray* commands, const char* name, ...) {
+    GPtrArray *argv = g_ptr_array_new();
+    g_ptr_array_add(argv, g_strdup(name));
 
-static int get_program_index(GNode *tree, char* program) {
-    char *names[1024];
-    int n = 0;
-
-    for (int i = 0; i < (int)g_node_n_children(tree); i++) {
-        GNode *parent = g_node_nth_child(tree, i);
-        VarEntry *ve = parent->data;
-
-        for (int j = 0; j < (int)g_node_n_children(parent); j++) {
-            GNode *child = g_node_nth_child(parent, j);
-            ve = child->data;
-
-            if(ve != NULL && ve->name[0] == program[0]) {
-                const char *str_type = tifiles_vartype2string(model, ve->type);
-                bool is_program = strcmp(&str_type[strlen(str_type) - 4], "PRGM") == 0;
-                if (
-                    strlen(str_type) >= 4
-                    && (
-                        is_program || strcmp(str_type, "APPL") == 0
-                    )
-                ) {
-                    names[n++] = ve->name;
-                    log(LEVEL_TRACE, "%s\n", names[n-1]);
-                }
-            }
-        }
+    va_list args;
+    va_start(args, name);
+    const char *arg;
+    while((arg = va_arg(args, const char*)) != NULL) {
+        g_ptr_array_add(argv, g_strdup(arg));
     }
+    va_end(args);
 
-    log(LEVEL_TRACE, "Sorting\n");
+    g_ptr_array_add(argv, NULL);
+    g_ptr_array_add(commands, g_ptr_array_free(argv, FALSE));
+}
 
-    qsort(names, n, sizeof(names[0]), compare);
-    for(int i = 0; i < n; i++) {
-        log(LEVEL_TRACE, "%s\n", names[i]);
-        if(strcmp(names[i], program) == 0) {
-            return i;
-        }
+/**
+ * The server may not share our working directory, so paths are sent whole.
+ */
+static char* absolute_path(const char* path) {
+    if(g_path_is_absolute(path)) {
+        return g_strdup(path);
     }
 
-    return -1;
+    char *cwd = g_get_current_dir();
+    char *absolute = g_build_filename(cwd, path, NULL);
+    g_free(cwd);
+    return absolute;
 }
 
-static VarEntry* get_program(GNode *tree, char* program) {
-    for (int i = 0; i < (int)g_node_n_children(tree); i++) {
-        GNode *parent = g_node_nth_child(tree, i);
-        VarEntry *ve = parent->data;
+/**
+ * The options given, as commands for actions_execute or a server.
+ */
+static GPtrArray* get_commands() {
+    GPtrArray *commands = g_ptr_array_new_with_free_func((GDestroyNotify)g_strfreev);
 
-        for (int j = 0; j < (int)g_node_n_children(parent); j++) {
-            GNode *child = g_node_nth_child(parent, j);
-            ve = child->data;
+    if(restore_name) {
+        char *store = absolute_path(store_path);
+        add_command(commands, "restore", store, restore_name, NULL);
+        g_free(store);
+    }
 
-            if(ve != NULL && strcmp(ve->name, program) == 0) {
-                return ve;
-            }
-        }
+    if(reset_ram) {
+        add_command(commands, "reset", "ram", NULL);
     }
 
-    return NULL;
-}
+    if(reset_archive_vars) {
+        add_command(commands, "reset", "archive", NULL);
+    }
 
-int start_app(GNode *apps, char *app_name, bool is_program) {
-    static const CalcModel allowed_models[] = {
-        CALC_TI83,
-        CALC_TI83P,
-        CALC_TI84P,
-        CALC_TI84P_USB,
-        CALC_TI84PC,
-        CALC_TI84PC_USB,
-        CALC_TI83PCE_USB,
-        CALC_TI84PCE_USB,
-        CALC_TI84PT_USB,
-    };
+    if(strlen(keys) > 0) {
+        add_command(commands, "keys", keys, NULL);
+    }
 
-    bool is_ti8x = false;
-    for(int i = 0; i < sizeof(allowed_models)/sizeof(allowed_models[0]); i++) {
-        if(allowed_models[i] == model) {
-            is_ti8x = true;
-            break;
-        }
+    if(macro) {
+        add_command(commands, "macro", macro, NULL);
     }
 
-    // We use my function for apps on TI8x, and the builtin for programs
-    if(is_program || !is_ti8x) {
-        VarEntry *app = get_program(apps, app_name);
-        if(app == NULL) {
-            return EXIT_FAILURE;
+    if(script_filename) {
+        gchar *script = NULL;
+        if(!g_file_get_contents(script_filename, &script, NULL, NULL)) {
+            log(LEVEL_ERROR, "Could not read script: %s\n", script_filename);
+            g_ptr_array_free(commands, TRUE);
+            return NULL;
         }
+        add_command(commands, "macro", script, NULL);
+        g_free(script);
+    }
 
-        if(is_ti8x && strcmp(tifiles_vartype2string(model, app->type), "PPRGM") == 0) {
-            // We remap TI8x assembly programs so noshell can do its work
-            // it doesn't like the Asm( token
-            app->type = tifiles_string2vartype(model, "PRGM");
+    if(sync_dir_path) {
+        // The server may not share our working directory
+        char *dir = realpath(sync_dir_path, NULL);
+        if(dir == NULL) {
+            log(LEVEL_ERROR, "Could not find %s\n", sync_dir_path);
+            g_ptr_array_free(commands, TRUE);
+            return NULL;
         }
-
-        ticalcs_calc_execute(calc_handle, app, "");
-
-        return EXIT_SUCCESS;
+        const char *mode = sync_archive ? "archive" : sync_unarchive ? "unarchive" : "keep";
+        add_command(commands, "sync", dir, mode, NULL);
+        free(dir);
     }
 
-    int app_idx = get_program_index(apps, app_name);
-    if(app_idx == -1) {
-        return EXIT_FAILURE;
+    if(backup_name) {
+        char *store = absolute_path(store_path);
+        add_command(commands, "backup", store, backup_name, NULL);
+        g_free(store);
     }
 
-    if(is_program) {
-        send_key(KEY83P_Prgm, 1);
-    }
-    else {
-        send_key(KEY83P_AppsMenu, 1);
+    if(strlen(exists_filename) > 0) {
+        char version[16], size[16];
+        sprintf(version, "%d", exists_version);
+        sprintf(size, "%d", exists_size);
+        add_command(commands, "exists", exists_filename, exists_type, version, size, NULL);
     }
-
-    send_key(keys_func(app_name[0])->normal.value, 1);
-
-    for(int i = 0; i < app_idx; i++) {
-        send_key(KEY83P_Down, 1);
+    else if(strlen(subtype) > 0 || strlen(program) > 0) {
+        add_command(commands, "launch", subtype, program, NULL);
     }
-    send_key(KEY83P_Enter, 0);
 
-    if(is_program) {
-        send_key(KEY83P_Enter, 0);
+    if(record_path) {
+        char *path = absolute_path(record_path);
+        add_command(commands, "record", path, record_time, NULL);
+        g_free(path);
     }
 
-    return EXIT_SUCCESS;
+    return commands;
 }
 
+static int run_commands(GPtrArray* commands, int fd) {
+    for(guint i = 0; i < commands->len; i++) {
+        char **argv = g_ptr_array_index(commands, i);
+        int result = fd != -1
+            ? client_command(fd, argv)
+            : actions_execute(&session, argv);
+        if(result != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
 
-void handle_sigint(int code) {
-    cleanup();
+    return EXIT_SUCCESS;
 }
 
 int main(int argc, char *argv[]) {
     struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
     sa.sa_handler = handle_sigint;
     sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
 
     utils_parse_args(argc, argv);
 
@@ -302,6 +428,37 @@ int main(int argc, char *argv[]) {
     log(LEVEL_TRACE, "Reset RAM: %d\n", reset_ram);
     log(LEVEL_TRACE, "Model Requested: %s\n", model_requested);
 
+    if(export_path) {
+        // A recording is exported next to itself, without the extension
+        char *prefix = g_strdup(export_path);
+        char *dot = strrchr(prefix, '.');
+        if(dot && strchr(dot, '/') == NULL) {
+            *dot = '\0';
+        }
+        bool ok = screenrec_export_png(export_path, prefix);
+        g_free(prefix);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    GPtrArray *commands = get_commands();
+    if(commands == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    if(socket_path) {
+        // The server has the cable, so there's nothing to set up here
+        int fd = client_connect(socket_path);
+        if(fd == -1) {
+            g_ptr_array_free(commands, TRUE);
+            return EXIT_FAILURE;
+        }
+
+        int result = run_commands(commands, fd);
+        close(fd);
+        g_ptr_array_free(commands, TRUE);
+        return result;
+    }
+
     if(strlen(model_requested) != 0) {
         model = ticalcs_string_to_model(model_requested);
         if(model == CALC_NONE) {
@@ -311,12 +468,15 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if(model == CALC_TI83P) {
-        keys_func = &ticalcs_keys_83p;
-    }
-
     ticables_library_init();
 
+    if(farm_jobs) {
+        int result = farm_run(model, dirlist_cache, farm_jobs, commands);
+        g_ptr_array_free(commands, TRUE);
+        cleanup();
+        return result;
+    }
+
     cable_handle = utils_setup_cable();
     if(cable_handle == NULL) {
         log(LEVEL_ERROR, "Cable not found!\n");
@@ -352,155 +512,16 @@ int main(int argc, char *argv[]) {
 
     ticables_options_set_timeout(cable_handle, CABLE_TIMEOUT);
 
-    calc_handle = ticalcs_handle_new(model);
-    ticalcs_cable_attach(calc_handle, cable_handle);
-
-    if(reset_ram) {
-        send_key(KEY83P_Quit, 1);
-        send_key(KEY83P_Clear, 1);
-
-        log(LEVEL_WARN, "Resetting RAM...\n");
-        send_key(KEY83P_ResetMem, 0);
-    }
-
-    if(reset_archive_vars) {
-        send_key(KEY83P_Quit, 1);
-        send_key(KEY83P_Clear, 1);
-
-        log(LEVEL_WARN, "Resetting archive vars...\n");
-
-        send_key(KEY83P_Mem, 1);
-        send_key(keys_func('7')->normal.value, 1);
-        send_key(KEY83P_Right, 1);
-        send_key(keys_func('1')->normal.value, 1);
-        send_key(keys_func('2')->normal.value, 0);
-    }
-
-    if(strlen(keys) > 0) {
-        for(int i = 0; i < strlen(keys); i++) {
-            send_key(keys_func(keys[i])->normal.value, 1);
-        }
-    }
-
-    if(strlen(exists_filename) > 0) {
-        log(LEVEL_INFO, "Checking for existence of file %s", exists_filename);
-
-        GNode *lists[2];
-        while((err = ticalcs_calc_get_dirlist(calc_handle, &lists[0], &lists[1])));
-
-        for (int l = 0; l < sizeof(lists) / sizeof(lists[0]); l++) {
-            for (int i = 0; i < (int)g_node_n_children(lists[l]); i++) {
-                GNode *parent = g_node_nth_child(lists[l], i);
-                VarEntry *ve = parent->data;
-
-                for (int j = 0; j < (int)g_node_n_children(parent); j++) {
-                    GNode *child = g_node_nth_child(parent, j);
-                    ve = child->data;
-
-                    if(ve != NULL && strcmp(ve->name, exists_filename) == 0) {
-                        log(LEVEL_INFO, "Found file: %s\n", exists_filename);
-                        if(exists_version >= 0 && ve->version != exists_version) {
-                            log(LEVEL_WARN, "Version didn't match: %d\n", ve->version);
-                            continue;
-                        }
-                        if(exists_size >= 0 && ve->size != exists_size) {
-                            log(LEVEL_WARN, "Size didn't match: %d\n", ve->size);
-                            continue;
-                        }
-                        const char* str_type = tifiles_vartype2string(model, ve->type);
-                        if(strlen(exists_type) > 0 && strcmp(exists_type, str_type) != 0) {
-                            log(LEVEL_WARN, "Type didn't match: %s\n", str_type);
-                            continue;
-                        }
-
-                        cleanup();
-                        return EXIT_SUCCESS;
-                    }
-                }
-            }
-        }
-
-        log(LEVEL_ERROR, "File not found: %s\n", exists_filename);
-        cleanup();
-        return EXIT_FAILURE;
-    }
-    else if(strlen(subtype) > 0 || strlen(program) > 0) {
-        log(LEVEL_DEBUG, "Got a program startup request.\n");
-
-        send_key(KEY83P_Quit, 1);
-        send_key(KEY83P_Clear, 1);
-
-        if(strcmp(subtype, "asm") == 0) {
-            log(LEVEL_ERROR, "asm is not supported! Start it manually!\n");
-            cleanup();
-            return EXIT_FAILURE;
-        }
-        else if(strcmp(subtype, "tse") == 0) {
-            log(LEVEL_ERROR, "tse is not supported! Start it manually!\n");
-            cleanup();
-            return EXIT_FAILURE;
-        }
-        else if(strcmp(subtype, "ion") == 0) {
-            log(LEVEL_WARN, "ion will be started, but you still need to start the program yourself.\n");
-            send_key(KEY83P_Prgm, 1);
-            send_key(keys_func('A')->normal.value, 1);
-            send_key(KEY83P_Enter, 1);
-            send_key(KEY83P_Enter, 0);
-        }
-        else if(strcmp(subtype, "mirage") == 0) {
-            log(LEVEL_WARN, "Mirage will be started, but you still need to start the program yourself.\n");
-
-            GNode *vars, *apps;
-            while((err = ticalcs_calc_get_dirlist(calc_handle, &vars, &apps)));
-
-            log(LEVEL_DEBUG, "Got dirlist\n");
-
-            if((err = start_app(apps, "MirageOS", 0))) {
-                log(LEVEL_ERROR, "Could not start MirageOS. Is it installed?\n");
-                cleanup();
-                return EXIT_FAILURE;
-            }
-        }
-        else if(strlen(program) > 0) {
-            if(strcmp(subtype, "noshell") != 0) {
-                log(LEVEL_WARN, "Subtype was not recognized! It will be started with noshell!\n");
-            }
+    calc_session_open(&session, model, cable_handle);
+    session.dirlist_cache = dirlist_cache;
 
-            GNode *vars, *apps;
-            while((err = ticalcs_calc_get_dirlist(calc_handle, &vars, &apps)));
+    int result = run_commands(commands, -1);
+    g_ptr_array_free(commands, TRUE);
 
-            log(LEVEL_DEBUG, "Got dirlist\n");
-
-            if(get_program(vars, program) == NULL) {
-                log(LEVEL_ERROR, "Could not find %s. Is it installed? Error %d\n", program, err);
-                cleanup();
-                return EXIT_FAILURE;
-            }
-
-            log(LEVEL_INFO, "Verifying that noshell is correctly hooked.\n");
-
-            if((err = start_app(apps, "Noshell ", 0))) {
-                log(LEVEL_ERROR, "Could not start Noshell. Is it installed?\n");
-                cleanup();
-                return EXIT_FAILURE;
-            }
-
-            ticables_options_set_timeout(cable_handle, CABLE_FAST_TIMEOUT);
-            send_key(keys_func('1')->normal.value, 0);
-            send_key(KEY83P_Enter, 0);
-            send_key(keys_func('6')->normal.value, 0);
-            ticables_options_set_timeout(cable_handle, CABLE_TIMEOUT);
-
-            if((err = start_app(vars, program, 1))) {
-                log(LEVEL_ERROR, "Could not start %s. Is it installed? Error %d\n", program, err);
-                cleanup();
-                return EXIT_FAILURE;
-            }
-
-            log(LEVEL_INFO, "Finished sucessfully!\n");
-        }
+    if(result == EXIT_SUCCESS && serve_path) {
+        result = server_run(&session, serve_path);
     }
 
     cleanup();
-    return EXIT_SUCCESS;
+    return result;
 }
@@ -0,0 +1,184 @@
+#include "actions.h"
+
+#include <glib-2.0/glib.h>
+#include <tilp2/tifiles.h>
+
+#include "../common/utils.h"
+#include "../common/dirlist.h"
+#include "../common/keymacro.h"
+#include "../common/launch.h"
+#include "../common/screenrec.h"
+#include "sync.h"
+#include "snapshot.h"
+
+static const char *macro_reset_ram = "QUIT CLEAR RESETMEM!";
+static const char *macro_reset_archive_vars = "QUIT CLEAR MEM '7' RIGHT '1' '2'!";
+
+static int action_exists(CalcSession* session, char** args) {
+    const char *filename = args[0];
+    const char *type = args[1];
+    int version = -1;
+    int size = -1;
+    sscanf(args[2], "%d", &version);
+    sscanf(args[3], "%d", &size);
+
+    log(LEVEL_INFO, "Checking for existence of file %s\n", filename);
+
+    Dirlist *dirlist = dirlist_get(session);
+    if(dirlist == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    for(int l = 0; l < DIRLIST_COUNT; l++) {
+        for(const GSList *it = dirlist_find_all(dirlist, l, filename); it; it = it->next) {
+            VarEntry *ve = it->data;
+
+            log(LEVEL_INFO, "Found file: %s\n", filename);
+            if(version >= 0 && ve->version != version) {
+                log(LEVEL_WARN, "Version didn't match: %d\n", ve->version);
+                continue;
+            }
+            if(size >= 0 && ve->size != size) {
+                log(LEVEL_WARN, "Size didn't match: %d\n", ve->size);
+                continue;
+            }
+            const char* str_type = tifiles_vartype2string(session->model, ve->type);
+            if(strlen(type) > 0 && strcmp(type, str_type) != 0) {
+                log(LEVEL_WARN, "Type didn't match: %s\n", str_type);
+                continue;
+            }
+
+            return EXIT_SUCCESS;
+        }
+    }
+
+    log(LEVEL_ERROR, "File not found: %s\n", filename);
+    return EXIT_FAILURE;
+}
+
+static int action_reset(CalcSession* session, char** args) {
+    const char *macro;
+    if(strcmp(args[0], "ram") == 0) {
+        log(LEVEL_WARN, "Resetting RAM...\n");
+        macro = macro_reset_ram;
+    }
+    else if(strcmp(args[0], "archive") == 0) {
+        log(LEVEL_WARN, "Resetting archive vars...\n");
+        macro = macro_reset_archive_vars;
+    }
+    else {
+        log(LEVEL_ERROR, "Unknown reset: %s\n", args[0]);
+        return EXIT_FAILURE;
+    }
+
+    int err = keymacro_play(session, macro);
+    dirlist_invalidate(session);
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int action_keys(CalcSession* session, char** args) {
+    calc_send_ascii(session, args[0]);
+    dirlist_invalidate(session);
+    return EXIT_SUCCESS;
+}
+
+static int action_macro(CalcSession* session, char** args) {
+    int err = keymacro_play(session, args[0]);
+    dirlist_invalidate(session);
+    if(err) {
+        log(LEVEL_ERROR, "Key macro failed: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int action_launch(CalcSession* session, char** args) {
+    log(LEVEL_DEBUG, "Got a program startup request.\n");
+
+    int err = launch_program(session, args[0], args[1], false);
+    // The program may create or delete variables while it runs
+    dirlist_invalidate(session);
+    return err;
+}
+
+static int action_sync(CalcSession* session, char** args) {
+    SYNC_ARCHIVE_MODE mode;
+    if(strcmp(args[1], "keep") == 0) {
+        mode = SYNC_KEEP;
+    }
+    else if(strcmp(args[1], "archive") == 0) {
+        mode = SYNC_ARCHIVE;
+    }
+    else if(strcmp(args[1], "unarchive") == 0) {
+        mode = SYNC_UNARCHIVE;
+    }
+    else {
+        log(LEVEL_ERROR, "Unknown archive mode: %s\n", args[1]);
+        return EXIT_FAILURE;
+    }
+
+    return sync_dir(session, args[0], mode);
+}
+
+static int action_backup(CalcSession* session, char** args) {
+    return snapshot_backup(session, args[0], args[1]);
+}
+
+static int action_restore(CalcSession* session, char** args) {
+    return snapshot_restore(session, args[0], args[1]);
+}
+
+static int action_record(CalcSession* session, char** args) {
+    unsigned long seconds = 0;
+    if(sscanf(args[1], "%lu", &seconds) != 1 || seconds == 0) {
+        log(LEVEL_ERROR, "Bad recording length: %s\n", args[1]);
+        return EXIT_FAILURE;
+    }
+
+    log(LEVEL_INFO, "Recording the screen to %s for %lus\n", args[0], seconds);
+    return screenrec_record(session, args[0], seconds * 1000);
+}
+
+static const struct {
+    const char *name;
+    int arg_count;
+    int (*func)(CalcSession* session, char** args);
+} actions[] = {
+    {"exists", 4, action_exists},
+    {"reset", 1, action_reset},
+    {"keys", 1, action_keys},
+    {"macro", 1, action_macro},
+    {"launch", 2, action_launch},
+    {"sync", 2, action_sync},
+    {"backup", 2, action_backup},
+    {"restore", 2, action_restore},
+    {"record", 2, action_record},
+};
+
+int actions_execute(CalcSession* session, char** argv) {
+    if(argv[0] == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    int arg_count = 0;
+    while(argv[arg_count + 1] != NULL) {
+        arg_count++;
+    }
+
+    for(int i = 0; i < sizeof(actions) / sizeof(actions[0]); i++) {
+        if(strcmp(actions[i].name, argv[0]) != 0) {
+            continue;
+        }
+
+        if(arg_count != actions[i].arg_count) {
+            log(LEVEL_ERROR, "%s takes %d arguments, got %d\n", argv[0], actions[i].arg_count, arg_count);
+            return EXIT_FAILURE;
+        }
+
+        return actions[i].func(session, &argv[1]);
+    }
+
+    log(LEVEL_ERROR, "Unknown command: %s\n", argv[0]);
+    return EXIT_FAILURE;
+}
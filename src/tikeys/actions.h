@@ -0,0 +1,24 @@
+#ifndef __TIKEYS_ACTIONS_H__
+#define __TIKEYS_ACTIONS_H__
+
+#include "../common/calc.h"
+
+/**
+ * Run one tikeys command against an open session. argv is the command name
+ * followed by its arguments:
+ *
+ *   exists NAME TYPE VERSION SIZE   TYPE may be empty, VERSION and SIZE -1
+ *   reset ram|archive
+ *   keys TEXT
+ *   macro SCRIPT
+ *   launch SUBTYPE PROGRAM
+ *   sync DIR keep|archive|unarchive
+ *   backup STORE NAME
+ *   restore STORE NAME
+ *   record FILE SECONDS
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int actions_execute(CalcSession* session, char** argv);
+
+#endif
@@ -0,0 +1,71 @@
+#include "client.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib-2.0/glib.h>
+
+#include "../common/utils.h"
+
+int client_connect(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        log(LEVEL_ERROR, "Socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        log(LEVEL_ERROR, "Could not connect to %s: %s\n", path, strerror(errno));
+        if(fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    return fd;
+}
+
+int client_command(int fd, char** argv) {
+    GString *line = g_string_new(NULL);
+    for(int i = 0; argv[i] != NULL; i++) {
+        gchar *arg = g_strescape(argv[i], NULL);
+        if(i > 0) {
+            g_string_append_c(line, '\t');
+        }
+        g_string_append(line, arg);
+        g_free(arg);
+    }
+    g_string_append_c(line, '\n');
+
+    ssize_t sent = send(fd, line->str, line->len, MSG_NOSIGNAL);
+    bool ok = sent == line->len;
+    g_string_free(line, TRUE);
+    if(!ok) {
+        log(LEVEL_ERROR, "Could not send %s to the server\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char reply[16];
+    size_t len = 0;
+    while(len < sizeof(reply) - 1) {
+        if(read(fd, &reply[len], 1) != 1) {
+            log(LEVEL_ERROR, "The server went away during %s\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        if(reply[len] == '\n') {
+            break;
+        }
+        len++;
+    }
+    reply[len] = '\0';
+
+    log(LEVEL_DEBUG, "%s: %s\n", argv[0], reply);
+
+    return strcmp(reply, "OK") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
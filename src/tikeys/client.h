@@ -0,0 +1,15 @@
+#ifndef __TIKEYS_CLIENT_H__
+#define __TIKEYS_CLIENT_H__
+
+/**
+ * Connect to a tikeys server. Returns -1 if it isn't running.
+ */
+int client_connect(const char* path);
+
+/**
+ * Send one command, as in actions.h, and wait for the result.
+ * Returns EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int client_command(int fd, char** argv);
+
+#endif
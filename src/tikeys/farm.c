@@ -0,0 +1,361 @@
+#include "farm.h"
+
+#include "actions.h"
+#include "../common/utils.h"
+#include "../common/calc.h"
+
+typedef struct {
+    int id;
+    char *line;
+    // char** per command
+    GPtrArray *commands;
+    int attempts;
+    // Bit per device that has run it
+    guint64 tried;
+    bool passed;
+    int passed_on;
+} FarmJob;
+
+typedef struct Farm Farm;
+
+typedef struct {
+    Farm *farm;
+    int index;
+    CableHandle *cable;
+    CalcSession session;
+    char *name;
+    int failures;
+    int jobs_run;
+    int jobs_failed;
+    bool healthy;
+    GThread *thread;
+} FarmDevice;
+
+struct Farm {
+    CalcModel model;
+    const char *dirlist_cache;
+    GPtrArray *setup;
+
+    FarmDevice devices[FARM_DEVICES_MAX];
+    int device_count;
+    GAsyncQueue *queue;
+
+    // Guards everything below, and the jobs' and devices' counters
+    GMutex lock;
+    // Broadcast when a job finishes or a device retires
+    GCond changed;
+    int remaining;
+    int healthy_count;
+};
+
+static void free_job(FarmJob* job) {
+    g_ptr_array_free(job->commands, TRUE);
+    g_free(job->line);
+    g_free(job);
+}
+
+static FarmJob* parse_job(int id, const char* line) {
+    gint argc;
+    gchar **argv = NULL;
+    GError *error = NULL;
+    if(!g_shell_parse_argv(line, &argc, &argv, &error)) {
+        log(LEVEL_ERROR, "Could not parse job %d: %s\n", id, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    FarmJob *job = g_new0(FarmJob, 1);
+    job->id = id;
+    job->line = g_strdup(line);
+    job->commands = g_ptr_array_new_with_free_func((GDestroyNotify)g_strfreev);
+
+    GPtrArray *command = g_ptr_array_new();
+    for(int i = 0; i <= argc; i++) {
+        if(i == argc || strcmp(argv[i], ";") == 0) {
+            if(command->len > 0) {
+                g_ptr_array_add(command, NULL);
+                g_ptr_array_add(job->commands, g_ptr_array_free(command, FALSE));
+                command = g_ptr_array_new();
+            }
+            continue;
+        }
+        g_ptr_array_add(command, g_strdup(argv[i]));
+    }
+    g_ptr_array_free(command, TRUE);
+    g_strfreev(argv);
+
+    return job;
+}
+
+static GPtrArray* load_jobs(const char* path) {
+    gchar *contents = NULL;
+    if(!g_file_get_contents(path, &contents, NULL, NULL)) {
+        log(LEVEL_ERROR, "Could not read jobs: %s\n", path);
+        return NULL;
+    }
+
+    GPtrArray *jobs = g_ptr_array_new();
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    for(int i = 0; lines[i] != NULL; i++) {
+        char *line = g_strstrip(lines[i]);
+        if(line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+
+        FarmJob *job = parse_job(i + 1, line);
+        if(job == NULL) {
+            g_ptr_array_foreach(jobs, (GFunc)free_job, NULL);
+            g_ptr_array_free(jobs, TRUE);
+            jobs = NULL;
+            break;
+        }
+        g_ptr_array_add(jobs, job);
+    }
+
+    g_strfreev(lines);
+    g_free(contents);
+    return jobs;
+}
+
+static int run_commands(CalcSession* session, GPtrArray* commands) {
+    for(guint i = 0; i < commands->len; i++) {
+        if(actions_execute(session, g_ptr_array_index(commands, i)) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Whether a healthy device other than this one hasn't run the job yet.
+ * Call with the lock held.
+ */
+static bool untried_elsewhere(Farm* farm, FarmJob* job, FarmDevice* device) {
+    for(int i = 0; i < farm->device_count; i++) {
+        FarmDevice *other = &farm->devices[i];
+        if(other != device && other->healthy && !(job->tried & (1ULL << i))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void retire(Farm* farm, FarmDevice* device) {
+    if(device->healthy) {
+        device->healthy = false;
+        farm->healthy_count--;
+        log(LEVEL_WARN, "Taking %s out of the farm\n", device->name);
+        g_cond_broadcast(&farm->changed);
+    }
+}
+
+/**
+ * The setup commands for one device. Every device runs them, so a recording
+ * or snapshot they write gets the device's name, like the dirlist cache.
+ */
+static GPtrArray* device_setup(GPtrArray* setup, FarmDevice* device) {
+    GPtrArray *commands = g_ptr_array_new_with_free_func((GDestroyNotify)g_strfreev);
+    for(guint i = 0; i < setup->len; i++) {
+        char **argv = g_strdupv(g_ptr_array_index(setup, i));
+        if(argv[0] && argv[1] && argv[2]) {
+            // record FILE SECONDS, backup STORE NAME
+            int own = strcmp(argv[0], "record") == 0 ? 1 : strcmp(argv[0], "backup") == 0 ? 2 : 0;
+            if(own) {
+                char *named = g_strdup_printf("%s.%s", argv[own], device->name);
+                g_free(argv[own]);
+                argv[own] = named;
+            }
+        }
+        g_ptr_array_add(commands, argv);
+    }
+
+    return commands;
+}
+
+static bool open_device(Farm* farm, FarmDevice* device) {
+    ticables_options_set_timeout(device->cable, CABLE_TIMEOUT);
+
+    int err = calc_session_open(&device->session, farm->model, device->cable);
+    if(err) {
+        log(LEVEL_ERROR, "Could not open %s: %d\n", device->name, err);
+        return false;
+    }
+
+    if(farm->dirlist_cache) {
+        // Every calculator has its own files
+        device->session.dirlist_cache = g_strdup_printf("%s.%s", farm->dirlist_cache, device->name);
+    }
+
+    if(farm->setup) {
+        GPtrArray *setup = device_setup(farm->setup, device);
+        int result = run_commands(&device->session, setup);
+        g_ptr_array_free(setup, TRUE);
+        if(result != EXIT_SUCCESS) {
+            log(LEVEL_ERROR, "Setup failed on %s\n", device->name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static gpointer worker(gpointer data) {
+    FarmDevice *device = data;
+    Farm *farm = device->farm;
+
+    if(!open_device(farm, device)) {
+        g_mutex_lock(&farm->lock);
+        retire(farm, device);
+        g_mutex_unlock(&farm->lock);
+        return NULL;
+    }
+
+    while(true) {
+        g_mutex_lock(&farm->lock);
+        bool done = farm->remaining == 0 || !device->healthy;
+        g_mutex_unlock(&farm->lock);
+        if(done) {
+            break;
+        }
+
+        FarmJob *job = g_async_queue_timeout_pop(farm->queue, G_USEC_PER_SEC / 10);
+        if(job == NULL) {
+            continue;
+        }
+
+        g_mutex_lock(&farm->lock);
+        bool leave = (job->tried & (1ULL << device->index)) && untried_elsewhere(farm, job, device);
+        if(leave) {
+            // Failed here before, so let another device have a go. Nothing
+            // changes for this one until some device finishes or retires.
+            g_async_queue_push(farm->queue, job);
+            g_cond_wait_until(&farm->changed, &farm->lock, g_get_monotonic_time() + G_USEC_PER_SEC);
+        }
+        g_mutex_unlock(&farm->lock);
+        if(leave) {
+            continue;
+        }
+
+        log(LEVEL_INFO, "%s: job %d: %s\n", device->name, job->id, job->line);
+        int result = run_commands(&device->session, job->commands);
+
+        g_mutex_lock(&farm->lock);
+        job->attempts++;
+        job->tried |= 1ULL << device->index;
+        device->jobs_run++;
+
+        bool requeue = false;
+        if(result == EXIT_SUCCESS) {
+            job->passed = true;
+            job->passed_on = device->index;
+            device->failures = 0;
+            farm->remaining--;
+        }
+        else {
+            device->jobs_failed++;
+            if(++device->failures >= FARM_DEVICE_FAILURES) {
+                retire(farm, device);
+            }
+
+            if(job->attempts < FARM_JOB_ATTEMPTS && farm->healthy_count > 0) {
+                log(LEVEL_WARN, "%s: job %d failed, rescheduling\n", device->name, job->id);
+                requeue = true;
+            }
+            else {
+                farm->remaining--;
+            }
+        }
+        g_cond_broadcast(&farm->changed);
+        g_mutex_unlock(&farm->lock);
+
+        if(requeue) {
+            g_async_queue_push(farm->queue, job);
+        }
+    }
+
+    return NULL;
+}
+
+int farm_run(CalcModel model, const char* dirlist_cache, const char* jobs_path, GPtrArray* setup) {
+    GPtrArray *jobs = load_jobs(jobs_path);
+    if(jobs == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    Farm *farm = g_new0(Farm, 1);
+    farm->model = model;
+    farm->dirlist_cache = dirlist_cache;
+    farm->setup = setup;
+    farm->queue = g_async_queue_new();
+    g_mutex_init(&farm->lock);
+    g_cond_init(&farm->changed);
+
+    CableHandle *cables[FARM_DEVICES_MAX];
+    farm->device_count = utils_setup_cables(cables, FARM_DEVICES_MAX);
+    if(farm->device_count == 0) {
+        log(LEVEL_ERROR, "Cable not found!\n");
+    }
+
+    farm->healthy_count = farm->device_count;
+    farm->remaining = jobs->len;
+    for(guint i = 0; i < jobs->len; i++) {
+        g_async_queue_push(farm->queue, g_ptr_array_index(jobs, i));
+    }
+
+    log(LEVEL_INFO, "Running %u jobs on %d calculators\n", jobs->len, farm->device_count);
+
+    for(int i = 0; i < farm->device_count; i++) {
+        FarmDevice *device = &farm->devices[i];
+        device->farm = farm;
+        device->index = i;
+        device->cable = cables[i];
+        device->healthy = true;
+        device->session.model = model;
+        device->session.cable = cables[i];
+        device->name = calc_session_link_id(&device->session);
+        device->thread = g_thread_new(device->name, worker, device);
+    }
+
+    for(int i = 0; i < farm->device_count; i++) {
+        g_thread_join(farm->devices[i].thread);
+    }
+
+    int failed = 0;
+    for(guint i = 0; i < jobs->len; i++) {
+        FarmJob *job = g_ptr_array_index(jobs, i);
+        if(job->passed) {
+            log(LEVEL_INFO, "PASS %s: %s\n", farm->devices[job->passed_on].name, job->line);
+        }
+        else {
+            log(LEVEL_ERROR, "FAIL after %d tries: %s\n", job->attempts, job->line);
+            failed++;
+        }
+    }
+
+    for(int i = 0; i < farm->device_count; i++) {
+        FarmDevice *device = &farm->devices[i];
+        log(
+            LEVEL_INFO, "%s: %d jobs, %d failed%s\n",
+            device->name, device->jobs_run, device->jobs_failed, device->healthy ? "" : ", taken out"
+        );
+
+        g_free((char*)device->session.dirlist_cache);
+        calc_session_close(&device->session);
+        ticables_cable_close(device->cable);
+        ticables_handle_del(device->cable);
+        g_free(device->name);
+    }
+
+    log(LEVEL_INFO, "%u jobs, %d failed\n", jobs->len, failed);
+
+    g_ptr_array_foreach(jobs, (GFunc)free_job, NULL);
+    g_ptr_array_free(jobs, TRUE);
+    g_async_queue_unref(farm->queue);
+    g_cond_clear(&farm->changed);
+    g_mutex_clear(&farm->lock);
+    g_free(farm);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,36 @@
+#ifndef __TIKEYS_FARM_H__
+#define __TIKEYS_FARM_H__
+
+#include <glib-2.0/glib.h>
+#include <tilp2/ticalcs.h>
+
+#define FARM_DEVICES_MAX 32
+// Tries per job, preferring a device that hasn't failed it yet
+#define FARM_JOB_ATTEMPTS 3
+// Failures in a row before a device stops taking jobs
+#define FARM_DEVICE_FAILURES 3
+
+/**
+ * Run jobs on every calculator attached, with a worker thread per cable
+ * pulling from a shared queue.
+ *
+ * Each line of the jobs file is one job: commands as in actions.h,
+ * separated by ; and quoted like a shell would, such as
+ *
+ *   sync build keep ; launch noshell TEST1 ; exists PASS "" -1 -1
+ *
+ * Blank lines and lines starting with # are skipped. The commands of a job
+ * all run on the same calculator.
+ *
+ * Every device runs setup (commands for actions_execute, or NULL) before
+ * it takes jobs, and a device that fails it takes none. A recording or
+ * backup in setup is written per device, as FILE.LINK or NAME.LINK (see
+ * calc_session_link_id). A failed job is
+ * queued again for a device that hasn't tried it if there is one. A device
+ * that fails FARM_DEVICE_FAILURES jobs in a row is taken out.
+ *
+ * Returns EXIT_SUCCESS if every job passed.
+ */
+int farm_run(CalcModel model, const char* dirlist_cache, const char* jobs_path, GPtrArray* setup);
+
+#endif
@@ -0,0 +1,115 @@
+#include "server.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib-2.0/glib.h>
+
+#include "actions.h"
+#include "../common/utils.h"
+
+static int listen_fd = -1;
+static char *socket_path = NULL;
+
+static bool already_running(struct sockaddr_un* addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool running = connect(fd, (struct sockaddr*)addr, sizeof(*addr)) == 0;
+    close(fd);
+    return running;
+}
+
+static void serve_client(CalcSession* session, int fd) {
+    FILE *in = fdopen(fd, "r");
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    while((len = getline(&line, &size, in)) > 0) {
+        if(line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        if(len == 0) {
+            continue;
+        }
+
+        gchar **argv = g_strsplit(line, "\t", -1);
+        for(int i = 0; argv[i] != NULL; i++) {
+            gchar *arg = g_strcompress(argv[i]);
+            g_free(argv[i]);
+            argv[i] = arg;
+        }
+
+        log(LEVEL_DEBUG, "Command: %s\n", argv[0]);
+        int result = actions_execute(session, argv);
+        g_strfreev(argv);
+
+        const char *reply = result == EXIT_SUCCESS ? "OK\n" : "FAIL\n";
+        if(send(fd, reply, strlen(reply), MSG_NOSIGNAL) < 0) {
+            break;
+        }
+    }
+
+    free(line);
+    fclose(in);
+}
+
+int server_run(CalcSession* session, const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        log(LEVEL_ERROR, "Socket path is too long: %s\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, path);
+
+    if(already_running(&addr)) {
+        log(LEVEL_ERROR, "A server is already listening on %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    // Left over from a server that didn't shut down cleanly
+    unlink(path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(
+        listen_fd == -1
+        || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))
+        || listen(listen_fd, 4)
+    ) {
+        log(LEVEL_ERROR, "Could not listen on %s: %s\n", path, strerror(errno));
+        server_stop();
+        return EXIT_FAILURE;
+    }
+    socket_path = g_strdup(path);
+
+    log(LEVEL_INFO, "Listening on %s\n", path);
+
+    while(listen_fd != -1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        serve_client(session, fd);
+    }
+
+    server_stop();
+    return EXIT_SUCCESS;
+}
+
+void server_stop(void) {
+    if(listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    if(socket_path) {
+        unlink(socket_path);
+        g_free(socket_path);
+        socket_path = NULL;
+    }
+}
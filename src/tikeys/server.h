@@ -0,0 +1,18 @@
+#ifndef __TIKEYS_SERVER_H__
+#define __TIKEYS_SERVER_H__
+
+#include "../common/calc.h"
+
+/**
+ * Keep the session open and run commands sent to a Unix socket, one
+ * connection at a time, until server_stop is called.
+ *
+ * Each request is a line of tab separated, g_strescape'd fields: the
+ * command and its arguments, as in actions.h. Each reply is a line with
+ * OK or FAIL. Logs stay on the server's stderr.
+ */
+int server_run(CalcSession* session, const char* path);
+
+void server_stop(void);
+
+#endif
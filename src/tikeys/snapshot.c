@@ -0,0 +1,408 @@
+#include "snapshot.h"
+
+#include <gio/gio.h>
+#include <glib-2.0/glib.h>
+#include <tilp2/tifiles.h>
+
+#include "../common/utils.h"
+#include "../common/dirlist.h"
+#include "../common/launch.h"
+
+typedef struct {
+    char *name;
+    uint8_t type;
+    uint8_t attr;
+    uint8_t version;
+    uint32_t size;
+    char *hash;
+} SnapshotEntry;
+
+static void entry_free(SnapshotEntry* entry) {
+    g_free(entry->name);
+    g_free(entry->hash);
+    g_free(entry);
+}
+
+static char* object_path(const char* store, const char* hash) {
+    char prefix[3] = { hash[0], hash[1], '\0' };
+    return g_build_filename(store, "objects", prefix, &hash[2], NULL);
+}
+
+static char* snapshot_path(const char* store, const char* name) {
+    return g_build_filename(store, "snapshots", name, NULL);
+}
+
+/**
+ * Run all of data through a zlib converter. Returns NULL on error.
+ */
+static guint8* convert(GConverter* converter, const guint8* data, gsize size, gsize* out_size) {
+    GByteArray *out = g_byte_array_new();
+    guint8 buffer[4096];
+    gsize done = 0;
+
+    while(true) {
+        gsize read = 0, written = 0;
+        GError *error = NULL;
+        GConverterResult result = g_converter_convert(
+            converter, &data[done], size - done, buffer, sizeof(buffer),
+            G_CONVERTER_INPUT_AT_END, &read, &written, &error
+        );
+        if(result == G_CONVERTER_ERROR) {
+            log(LEVEL_DEBUG, "zlib: %s\n", error->message);
+            g_error_free(error);
+            g_byte_array_free(out, TRUE);
+            return NULL;
+        }
+
+        done += read;
+        g_byte_array_append(out, buffer, written);
+        if(result == G_CONVERTER_FINISHED) {
+            break;
+        }
+    }
+
+    *out_size = out->len;
+    return g_byte_array_free(out, FALSE);
+}
+
+static bool store_object(const char* store, const char* hash, const uint8_t* data, uint32_t size) {
+    char *path = object_path(store, hash);
+    if(g_file_test(path, G_FILE_TEST_EXISTS)) {
+        g_free(path);
+        return true;
+    }
+
+    GZlibCompressor *compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB, -1);
+    gsize compressed_size;
+    guint8 *compressed = convert(G_CONVERTER(compressor), data, size, &compressed_size);
+    g_object_unref(compressor);
+
+    char *dir = g_path_get_dirname(path);
+    bool ok = compressed
+        && g_mkdir_with_parents(dir, 0755) == 0
+        && g_file_set_contents(path, (const gchar*)compressed, compressed_size, NULL);
+    if(!ok) {
+        log(LEVEL_ERROR, "Could not write %s\n", path);
+    }
+
+    g_free(dir);
+    g_free(compressed);
+    g_free(path);
+    return ok;
+}
+
+/**
+ * The object's data, checked against its hash, or NULL.
+ */
+static uint8_t* load_object(const char* store, const char* hash, uint32_t size) {
+    char *path = object_path(store, hash);
+    gchar *compressed = NULL;
+    gsize compressed_size;
+    if(!g_file_get_contents(path, &compressed, &compressed_size, NULL)) {
+        log(LEVEL_ERROR, "Missing from the store: %s\n", path);
+        g_free(path);
+        return NULL;
+    }
+
+    GZlibDecompressor *decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
+    gsize data_size = 0;
+    guint8 *data = convert(G_CONVERTER(decompressor), (const guint8*)compressed, compressed_size, &data_size);
+    g_object_unref(decompressor);
+    g_free(compressed);
+
+    gchar *actual = data ? g_compute_checksum_for_data(G_CHECKSUM_SHA256, data, data_size) : NULL;
+    if(actual == NULL || data_size != size || strcmp(actual, hash) != 0) {
+        log(LEVEL_ERROR, "Corrupt object in the store: %s\n", path);
+        g_free(data);
+        data = NULL;
+    }
+
+    g_free(actual);
+    g_free(path);
+    return data;
+}
+
+/**
+ * Fetch a variable's data from the calculator. Free with g_free.
+ */
+static uint8_t* fetch(CalcSession* session, VarEntry* ve, uint32_t* size) {
+    FileContent *content = tifiles_content_create_regular(session->model);
+    uint8_t *data = NULL;
+    int err = ticalcs_calc_recv_var(session->calc, MODE_NORMAL, content, ve);
+    if(err) {
+        log(LEVEL_ERROR, "Could not fetch %s: %d\n", ve->name, err);
+    }
+    else if(content->num_entries > 0) {
+        VarEntry *fetched = content->entries[0];
+        data = g_malloc(fetched->size);
+        memcpy(data, fetched->data, fetched->size);
+        *size = fetched->size;
+    }
+
+    tifiles_content_delete_regular(content);
+    return data;
+}
+
+static GPtrArray* load_snapshot(const char* path, CalcModel model) {
+    gchar *contents = NULL;
+    if(!g_file_get_contents(path, &contents, NULL, NULL)) {
+        log(LEVEL_ERROR, "Could not read snapshot %s\n", path);
+        return NULL;
+    }
+
+    GPtrArray *entries = g_ptr_array_new_with_free_func((GDestroyNotify)entry_free);
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    int version = 0, snapshot_model = 0;
+    if(lines[0] == NULL || sscanf(lines[0], SNAPSHOT_MAGIC " %d %d", &version, &snapshot_model) != 2 || version != SNAPSHOT_VERSION) {
+        log(LEVEL_ERROR, "Not a snapshot: %s\n", path);
+        g_strfreev(lines);
+        g_ptr_array_free(entries, TRUE);
+        return NULL;
+    }
+
+    if(snapshot_model != model) {
+        log(LEVEL_WARN, "Snapshot was taken from a %s\n", ticalcs_model_to_string(snapshot_model));
+    }
+
+    for(int i = 1; lines[i] != NULL; i++) {
+        if(*lines[i] == '\0') {
+            continue;
+        }
+
+        gchar **fields = g_strsplit(lines[i], "\t", 6);
+        unsigned int type, attr, var_version, size;
+        if(
+            g_strv_length(fields) != 6
+            || sscanf(fields[1], "%x", &type) != 1
+            || sscanf(fields[2], "%u", &attr) != 1
+            || sscanf(fields[3], "%u", &var_version) != 1
+            || sscanf(fields[4], "%u", &size) != 1
+        ) {
+            log(LEVEL_ERROR, "Bad line %d in snapshot %s\n", i + 1, path);
+            g_strfreev(fields);
+            g_strfreev(lines);
+            g_ptr_array_free(entries, TRUE);
+            return NULL;
+        }
+
+        SnapshotEntry *entry = g_new0(SnapshotEntry, 1);
+        entry->name = g_strcompress(fields[0]);
+        entry->type = type;
+        entry->attr = attr;
+        entry->version = var_version;
+        entry->size = size;
+        entry->hash = g_strdup(fields[5]);
+        g_ptr_array_add(entries, entry);
+        g_strfreev(fields);
+    }
+
+    g_strfreev(lines);
+    return entries;
+}
+
+int snapshot_backup(CalcSession* session, const char* store, const char* name) {
+    Dirlist *dirlist = dirlist_get_fresh(session);
+    if(dirlist == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    // The OS only takes transfers from the home screen
+    if(launch_home(session)) {
+        log(LEVEL_ERROR, "Could not get to the home screen\n");
+        return EXIT_FAILURE;
+    }
+
+    GString *out = g_string_new(NULL);
+    g_string_append_printf(out, SNAPSHOT_MAGIC " %d %d\n", SNAPSHOT_VERSION, session->model);
+
+    GPtrArray *vars = dirlist->lists[DIRLIST_VARS].entries;
+    bool ok = true;
+    for(guint i = 0; i < vars->len && ok; i++) {
+        VarEntry *ve = g_ptr_array_index(vars, i);
+
+        uint32_t size = 0;
+        uint8_t *data = fetch(session, ve, &size);
+        if(data == NULL) {
+            ok = false;
+            break;
+        }
+
+        gchar *hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256, data, size);
+        ok = store_object(store, hash, data, size);
+
+        gchar *escaped = g_strescape(ve->name, NULL);
+        g_string_append_printf(out, "%s\t%02x\t%u\t%u\t%u\t%s\n", escaped, ve->type, ve->attr, ve->version, size, hash);
+        g_free(escaped);
+        g_free(hash);
+        g_free(data);
+    }
+
+    // A partial snapshot would delete what it missed on restore
+    char *path = snapshot_path(store, name);
+    char *dir = g_path_get_dirname(path);
+    if(ok && (g_mkdir_with_parents(dir, 0755) != 0 || !g_file_set_contents(path, out->str, out->len, NULL))) {
+        log(LEVEL_ERROR, "Could not write snapshot %s\n", path);
+        ok = false;
+    }
+
+    if(ok) {
+        log(LEVEL_INFO, "Saved %u variables as %s\n", vars->len, name);
+    }
+
+    g_free(dir);
+    g_free(path);
+    g_string_free(out, TRUE);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool in_snapshot(GPtrArray* entries, VarEntry* ve) {
+    for(guint i = 0; i < entries->len; i++) {
+        SnapshotEntry *entry = g_ptr_array_index(entries, i);
+        if(entry->type == ve->type && strcmp(entry->name, ve->name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Whether the calculator already has this entry's data.
+ */
+static bool matches(CalcSession* session, VarEntry* ve, SnapshotEntry* entry) {
+    if(ve == NULL || ve->size != entry->size) {
+        return false;
+    }
+
+    uint32_t size = 0;
+    uint8_t *data = fetch(session, ve, &size);
+    if(data == NULL) {
+        return false;
+    }
+
+    gchar *hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256, data, size);
+    bool same = strcmp(hash, entry->hash) == 0;
+    g_free(hash);
+    g_free(data);
+    return same;
+}
+
+int snapshot_restore(CalcSession* session, const char* store, const char* name) {
+    char *path = snapshot_path(store, name);
+    GPtrArray *entries = load_snapshot(path, session->model);
+    g_free(path);
+    if(entries == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    Dirlist *dirlist = dirlist_get_fresh(session);
+    if(dirlist == NULL || launch_home(session)) {
+        log(LEVEL_ERROR, "Could not get the calculator ready to restore\n");
+        g_ptr_array_free(entries, TRUE);
+        return EXIT_FAILURE;
+    }
+
+    int deleted = 0, sent = 0, moved = 0, unchanged = 0, failed = 0;
+    // Variables deleted to make way for the transfer, lost if it fails
+    GString *replaced = g_string_new(NULL);
+
+    GPtrArray *vars = dirlist->lists[DIRLIST_VARS].entries;
+    for(guint i = 0; i < vars->len; i++) {
+        VarEntry *ve = g_ptr_array_index(vars, i);
+        if(in_snapshot(entries, ve)) {
+            continue;
+        }
+
+        VarEntry request = *ve;
+        int err = ticalcs_calc_del_var(session->calc, &request);
+        if(err) {
+            log(LEVEL_ERROR, "Could not delete %s: %d\n", ve->name, err);
+            failed++;
+        }
+        else {
+            log(LEVEL_DEBUG, "Deleted %s\n", ve->name);
+            deleted++;
+        }
+    }
+
+    // Everything that differs goes over in one transfer
+    FileContent *content = tifiles_content_create_regular(session->model);
+    for(guint i = 0; i < entries->len; i++) {
+        SnapshotEntry *entry = g_ptr_array_index(entries, i);
+        VarEntry *ve = dirlist_find_type(dirlist, DIRLIST_VARS, entry->name, entry->type);
+
+        if(matches(session, ve, entry)) {
+            if(ve->attr != entry->attr) {
+                VarEntry request = *ve;
+                int err = ticalcs_calc_change_attr(session->calc, &request, entry->attr);
+                if(err) {
+                    log(LEVEL_ERROR, "Could not change %s's attributes: %d\n", ve->name, err);
+                    failed++;
+                }
+                else {
+                    moved++;
+                }
+            }
+            unchanged++;
+            continue;
+        }
+
+        uint8_t *data = load_object(store, entry->hash, entry->size);
+        if(data == NULL) {
+            failed++;
+            continue;
+        }
+
+        if(ve) {
+            // Archived variables can't be overwritten in place
+            VarEntry request = *ve;
+            int err = ticalcs_calc_del_var(session->calc, &request);
+            if(err) {
+                log(LEVEL_WARN, "Could not delete %s before sending it: %d\n", ve->name, err);
+            }
+            else {
+                g_string_append_printf(replaced, " %s", ve->name);
+            }
+        }
+
+        VarEntry *out = tifiles_ve_create();
+        g_strlcpy(out->name, entry->name, sizeof(out->name));
+        out->type = entry->type;
+        out->attr = entry->attr;
+        out->version = entry->version;
+        out->size = entry->size;
+        out->data = tifiles_ve_alloc_data(entry->size);
+        memcpy(out->data, data, entry->size);
+        tifiles_content_add_entry(content, out);
+        g_free(data);
+
+        log(LEVEL_DEBUG, "Restoring %s\n", entry->name);
+    }
+
+    if(content->num_entries > 0) {
+        int err = ticalcs_calc_send_var(session->calc, MODE_NORMAL, content);
+        if(err) {
+            log(LEVEL_ERROR, "Could not send the variables: %d\n", err);
+            if(replaced->len > 0) {
+                log(LEVEL_ERROR, "These were deleted from the calculator to be replaced:%s\n", replaced->str);
+            }
+            failed += content->num_entries;
+        }
+        else {
+            sent = content->num_entries;
+        }
+    }
+    tifiles_content_delete_regular(content);
+
+    g_string_free(replaced, TRUE);
+
+    if(deleted > 0 || sent > 0 || moved > 0 || failed > 0) {
+        dirlist_invalidate(session);
+    }
+
+    log(LEVEL_INFO, "Restored %s: sent %d, deleted %d, moved %d, unchanged %d, failed %d\n", name, sent, deleted, moved, unchanged, failed);
+
+    g_ptr_array_free(entries, TRUE);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
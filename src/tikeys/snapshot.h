@@ -0,0 +1,36 @@
+#ifndef __TIKEYS_SNAPSHOT_H__
+#define __TIKEYS_SNAPSHOT_H__
+
+#include "../common/calc.h"
+
+#define SNAPSHOT_MAGIC "TISNAPSHOT"
+#define SNAPSHOT_VERSION 1
+
+/**
+ * Snapshots of a calculator's variables, kept in a store directory:
+ *
+ *   STORE/objects/ab/cdef...   zlib compressed variable data, named by the
+ *                              SHA-256 of the uncompressed data
+ *   STORE/snapshots/NAME       one line per variable: name, type, attr,
+ *                              version, size and hash
+ *
+ * Variables that are the same across snapshots are only stored once, so
+ * backing up after a small change only adds what changed. Apps aren't
+ * included.
+ */
+
+/**
+ * Fetch every variable and save them as snapshot NAME.
+ */
+int snapshot_backup(CalcSession* session, const char* store, const char* name);
+
+/**
+ * Put the calculator's variables back to snapshot NAME, sending only those
+ * that differ and deleting those that aren't in it.
+ *
+ * Variables whose size matches the snapshot are fetched and hashed to
+ * compare, which is still cheaper than sending them, especially to archive.
+ */
+int snapshot_restore(CalcSession* session, const char* store, const char* name);
+
+#endif
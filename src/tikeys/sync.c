@@ -0,0 +1,363 @@
+#include "sync.h"
+
+#include <glib-2.0/glib.h>
+#include <tilp2/tifiles.h>
+
+#include "../common/utils.h"
+#include "../common/dirlist.h"
+#include "../common/launch.h"
+
+typedef struct {
+    CalcSession *session;
+    Dirlist *dirlist;
+    SYNC_ARCHIVE_MODE mode;
+    // "KIND:TYPE:NAME" -> "SIZE SHA256", as last sent or checked
+    GHashTable *state;
+    bool at_home;
+    int sent;
+    // Changed between RAM and archive
+    int moved;
+    int unchanged;
+    int failed;
+} SyncJob;
+
+static char* state_key(DIRLIST_KIND kind, uint8_t type, const char* name) {
+    return g_strdup_printf("%d:%02x:%s", kind, type, name);
+}
+
+static GHashTable* load_state(const char* path) {
+    GHashTable *state = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    gchar *contents = NULL;
+    if(!g_file_get_contents(path, &contents, NULL, NULL)) {
+        return state;
+    }
+
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    for(int i = 0; lines[i] != NULL; i++) {
+        gchar **fields = g_strsplit(lines[i], "\t", 2);
+        if(g_strv_length(fields) == 2) {
+            gchar *key = g_strcompress(fields[0]);
+            g_hash_table_replace(state, key, g_strdup(fields[1]));
+        }
+        g_strfreev(fields);
+    }
+
+    g_strfreev(lines);
+    g_free(contents);
+    return state;
+}
+
+static void save_state(GHashTable* state, const char* path) {
+    GString *out = g_string_new(NULL);
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, state);
+    while(g_hash_table_iter_next(&iter, &key, &value)) {
+        gchar *escaped = g_strescape(key, NULL);
+        g_string_append_printf(out, "%s\t%s\n", escaped, (const char*)value);
+        g_free(escaped);
+    }
+
+    if(!g_file_set_contents(path, out->str, out->len, NULL)) {
+        log(LEVEL_WARN, "Could not save sync state to %s\n", path);
+    }
+    g_string_free(out, TRUE);
+}
+
+static void record(SyncJob* job, DIRLIST_KIND kind, uint8_t type, const char* name, uint32_t size, const char* hash) {
+    g_hash_table_replace(job->state, state_key(kind, type, name), g_strdup_printf("%u %s", size, hash));
+}
+
+static bool recorded(SyncJob* job, DIRLIST_KIND kind, uint8_t type, const char* name, uint32_t size, const char* hash) {
+    char *key = state_key(kind, type, name);
+    const char *value = g_hash_table_lookup(job->state, key);
+    g_free(key);
+
+    if(value == NULL) {
+        return false;
+    }
+
+    char *expected = g_strdup_printf("%u %s", size, hash);
+    bool same = strcmp(value, expected) == 0;
+    g_free(expected);
+    return same;
+}
+
+static bool go_home(SyncJob* job) {
+    if(!job->at_home) {
+        // The OS only takes transfers from the home screen
+        job->at_home = launch_home(job->session) == 0;
+    }
+    return job->at_home;
+}
+
+/**
+ * Hash of the variable as it is on the calculator, or NULL.
+ */
+static gchar* fetch_hash(SyncJob* job, VarEntry* ve) {
+    if(!go_home(job)) {
+        return NULL;
+    }
+
+    FileContent *content = tifiles_content_create_regular(job->session->model);
+    gchar *hash = NULL;
+    int err = ticalcs_calc_recv_var(job->session->calc, MODE_NORMAL, content, ve);
+    if(err) {
+        log(LEVEL_WARN, "Could not fetch %s to compare: %d\n", ve->name, err);
+    }
+    else if(content->num_entries > 0) {
+        VarEntry *fetched = content->entries[0];
+        hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256, fetched->data, fetched->size);
+    }
+
+    tifiles_content_delete_regular(content);
+    return hash;
+}
+
+static bool is_program(SyncJob* job, uint8_t type) {
+    const char *name = tifiles_vartype2string(job->session->model, type);
+    return strcmp(name, "PRGM") == 0 || strcmp(name, "PPRGM") == 0;
+}
+
+/**
+ * The calculator's copy of a variable. Programs match whether or not
+ * they're protected, since a rebuild can switch between the two.
+ */
+static VarEntry* find_var(SyncJob* job, VarEntry* entry) {
+    VarEntry *ve = dirlist_find_type(job->dirlist, DIRLIST_VARS, entry->name, entry->type);
+    if(ve || !is_program(job, entry->type)) {
+        return ve;
+    }
+
+    for(const GSList *it = dirlist_find_all(job->dirlist, DIRLIST_VARS, entry->name); it; it = it->next) {
+        VarEntry *other = it->data;
+        if(is_program(job, other->type)) {
+            return other;
+        }
+    }
+
+    return NULL;
+}
+
+static bool var_changed(SyncJob* job, VarEntry* entry, const char* hash) {
+    VarEntry *ve = find_var(job, entry);
+    if(ve == NULL) {
+        log(LEVEL_DEBUG, "%s is new\n", entry->name);
+        return true;
+    }
+
+    if(ve->type != entry->type || ve->size != entry->size) {
+        log(LEVEL_DEBUG, "%s changed type or size\n", entry->name);
+        return true;
+    }
+
+    if(recorded(job, DIRLIST_VARS, entry->type, entry->name, entry->size, hash)) {
+        log(LEVEL_DEBUG, "%s matches what was last synced\n", entry->name);
+        return false;
+    }
+
+    // Nothing recorded for this file, so only what's on the calculator counts
+    gchar *calc_hash = fetch_hash(job, ve);
+    bool changed = calc_hash == NULL || strcmp(calc_hash, hash) != 0;
+    g_free(calc_hash);
+
+    log(LEVEL_DEBUG, "%s %s on the calculator\n", entry->name, changed ? "differs" : "matches");
+    if(!changed) {
+        record(job, DIRLIST_VARS, entry->type, entry->name, entry->size, hash);
+    }
+    return changed;
+}
+
+static void set_attr(SyncJob* job, VarEntry* ve, uint8_t attr) {
+    if(ve->attr == attr || !go_home(job)) {
+        return;
+    }
+
+    VarEntry request = *ve;
+    int err = ticalcs_calc_change_attr(job->session->calc, &request, attr);
+    if(err) {
+        log(LEVEL_WARN, "Could not %s %s: %d\n", attr == ATTRB_ARCHIVED ? "archive" : "unarchive", ve->name, err);
+    }
+    else {
+        job->moved++;
+    }
+}
+
+/**
+ * Returns false if the calculator's copy is still there, and sending over
+ * it would fail or leave both.
+ */
+static bool delete_existing(SyncJob* job, VarEntry* ve, const char* name) {
+    if(ve == NULL) {
+        return true;
+    }
+
+    // Archived variables can't be overwritten in place
+    VarEntry request = *ve;
+    int err = ticalcs_calc_del_var(job->session->calc, &request);
+    if(err) {
+        log(LEVEL_ERROR, "Could not delete %s before sending: %d\n", name, err);
+        return false;
+    }
+    return true;
+}
+
+static void sync_regular(SyncJob* job, const char* path) {
+    FileContent *content = tifiles_content_create_regular(job->session->model);
+    if(tifiles_file_read_regular(path, content)) {
+        log(LEVEL_ERROR, "Could not read %s\n", path);
+        tifiles_content_delete_regular(content);
+        job->failed++;
+        return;
+    }
+
+    uint8_t attr = job->mode == SYNC_ARCHIVE ? ATTRB_ARCHIVED : ATTRB_NONE;
+    gchar **hashes = g_new0(gchar*, content->num_entries + 1);
+    bool changed = false;
+    for(int i = 0; i < content->num_entries; i++) {
+        VarEntry *entry = content->entries[i];
+        hashes[i] = g_compute_checksum_for_data(G_CHECKSUM_SHA256, entry->data, entry->size);
+        changed |= var_changed(job, entry, hashes[i]);
+    }
+
+    if(!changed) {
+        for(int i = 0; i < content->num_entries; i++) {
+            VarEntry *entry = content->entries[i];
+            if(job->mode != SYNC_KEEP) {
+                set_attr(job, find_var(job, entry), attr);
+            }
+        }
+        job->unchanged++;
+    }
+    else if(go_home(job)) {
+        log(LEVEL_INFO, "Sending %s\n", path);
+        bool deleted = true;
+        for(int i = 0; i < content->num_entries; i++) {
+            VarEntry *entry = content->entries[i];
+            deleted &= delete_existing(job, find_var(job, entry), entry->name);
+            entry->attr = attr;
+        }
+
+        int err = 0;
+        if(!deleted) {
+            job->failed++;
+        }
+        else if((err = ticalcs_calc_send_var(job->session->calc, MODE_NORMAL, content))) {
+            log(LEVEL_ERROR, "Could not send %s: %d\n", path, err);
+            job->failed++;
+        }
+        else {
+            for(int i = 0; i < content->num_entries; i++) {
+                VarEntry *entry = content->entries[i];
+                record(job, DIRLIST_VARS, entry->type, entry->name, entry->size, hashes[i]);
+            }
+            job->sent++;
+        }
+    }
+    else {
+        job->failed++;
+    }
+
+    g_strfreev(hashes);
+    tifiles_content_delete_regular(content);
+}
+
+static void sync_flash(SyncJob* job, const char* path) {
+    gchar *data = NULL;
+    gsize size = 0;
+    FlashContent *content = tifiles_content_create_flash(job->session->model);
+    if(!g_file_get_contents(path, &data, &size, NULL) || tifiles_file_read_flash(path, content)) {
+        log(LEVEL_ERROR, "Could not read %s\n", path);
+        g_free(data);
+        tifiles_content_delete_flash(content);
+        job->failed++;
+        return;
+    }
+
+    // Apps are hashed as whole files, since that's all there is to compare
+    gchar *hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar*)data, size);
+    g_free(data);
+
+    bool present = dirlist_find(job->dirlist, DIRLIST_APPS, content->name) != NULL;
+    if(present && recorded(job, DIRLIST_APPS, 0, content->name, size, hash)) {
+        job->unchanged++;
+    }
+    else if(go_home(job)) {
+        log(LEVEL_INFO, "Sending %s\n", path);
+        int err = 0;
+        if(!delete_existing(job, dirlist_find(job->dirlist, DIRLIST_APPS, content->name), content->name)) {
+            job->failed++;
+        }
+        else if((err = ticalcs_calc_send_app(job->session->calc, content))) {
+            log(LEVEL_ERROR, "Could not send %s: %d\n", path, err);
+            job->failed++;
+        }
+        else {
+            record(job, DIRLIST_APPS, 0, content->name, size, hash);
+            job->sent++;
+        }
+    }
+    else {
+        job->failed++;
+    }
+
+    g_free(hash);
+    tifiles_content_delete_flash(content);
+}
+
+int sync_dir(CalcSession* session, const char* dir, SYNC_ARCHIVE_MODE mode) {
+    GDir *handle = g_dir_open(dir, 0, NULL);
+    if(handle == NULL) {
+        log(LEVEL_ERROR, "Could not open %s\n", dir);
+        return EXIT_FAILURE;
+    }
+
+    SyncJob job = {
+        .session = session,
+        .dirlist = dirlist_get(session),
+        .mode = mode,
+    };
+    if(job.dirlist == NULL) {
+        g_dir_close(handle);
+        return EXIT_FAILURE;
+    }
+
+    // Each calculator has its own state, so a farm can share the directory
+    char *link = calc_session_link_id(session);
+    char *state_name = g_strdup_printf("%s.%s", SYNC_STATE_FILE, link);
+    char *state_path = g_build_filename(dir, state_name, NULL);
+    g_free(state_name);
+    g_free(link);
+    job.state = load_state(state_path);
+
+    const char *name;
+    while((name = g_dir_read_name(handle))) {
+        char *lower = g_ascii_strdown(name, -1);
+        char *path = g_build_filename(dir, name, NULL);
+
+        if(g_str_has_suffix(lower, ".8xp")) {
+            sync_regular(&job, path);
+        }
+        else if(g_str_has_suffix(lower, ".8xk")) {
+            sync_flash(&job, path);
+        }
+
+        g_free(path);
+        g_free(lower);
+    }
+    g_dir_close(handle);
+
+    save_state(job.state, state_path);
+    g_hash_table_destroy(job.state);
+    g_free(state_path);
+
+    // A failed send may still have deleted the old copy
+    if(job.sent > 0 || job.moved > 0 || job.failed > 0) {
+        dirlist_invalidate(session);
+    }
+
+    log(LEVEL_INFO, "Sent %d, unchanged %d, failed %d\n", job.sent, job.unchanged, job.failed);
+
+    return job.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,35 @@
+#ifndef __TIKEYS_SYNC_H__
+#define __TIKEYS_SYNC_H__
+
+#include "../common/calc.h"
+
+#define SYNC_STATE_FILE ".tikeys-sync"
+
+typedef enum {
+    // Send to RAM, and leave variables that didn't change where they are
+    SYNC_KEEP,
+    SYNC_ARCHIVE,
+    SYNC_UNARCHIVE,
+} SYNC_ARCHIVE_MODE;
+
+/**
+ * Send the .8xp and .8xk files in a directory that aren't already on the
+ * calculator, using one dirlist fetch for the whole directory.
+ *
+ * A variable is sent if it's missing or its type or size differs, with
+ * programs matched by name whether or not they're protected. Otherwise it's
+ * compared with the size and SHA-256 recorded when it was last sent to, or
+ * checked on, this calculator, in SYNC_STATE_FILE.LINK (see
+ * calc_session_link_id). Only without a matching record is it fetched and
+ * hashed. Apps can't be fetched cheaply, so they're sent unless the record
+ * matches. Something changed on the calculator without changing its size,
+ * or replaced by other means, is not noticed once recorded.
+ *
+ * The calculator's copy is deleted first, and if that fails, the file
+ * isn't sent and counts as a failure.
+ *
+ * Returns EXIT_SUCCESS if everything that needed sending was sent.
+ */
+int sync_dir(CalcSession* session, const char* dir, SYNC_ARCHIVE_MODE mode);
+
+#endif